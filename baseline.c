@@ -0,0 +1,209 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A seasonal baseline of the memory usage, for each hour of the week
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/file.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "baseline.h"
+#include "nputils.h"
+#include "state.h"
+
+/* The state file is made of fixed size records, so that a run only reads
+ * and rewrites the header and the record of the current hour:
+ *
+ * baseline 1412243163
+ * 1411638363   2  62.1503    14.2117   3.0125     0.0310
+ * ...
+ *
+ * The header keeps the time of the last update, and each one of the
+ * 7 * 24 records the time of the last update of the hour, the weeks of
+ * history, and the mean and the variance of each metric.
+ */
+
+#define BASELINE_SLOTS		(7 * 24)
+#define BASELINE_SLOT_SECONDS	3600
+#define BASELINE_RECORD		64
+
+/* the weight of the samples of an hour of the current week: the baseline
+ * follows roughly the last four weeks
+ */
+#define BASELINE_WEIGHT		0.25
+/* a floor for the standard deviation (percentage points), the usage of
+ * an idle host is almost constant
+ */
+#define BASELINE_MIN_STDDEV	1.0
+/* the interval assumed for the first run */
+#define BASELINE_INTERVAL	300
+
+static int
+baseline_read (int fd, int record, char *buf)
+{
+  ssize_t n;
+
+  n = pread (fd, buf, BASELINE_RECORD, (off_t) record * BASELINE_RECORD);
+  if (n < 0)
+    n = 0;
+  buf[n] = '\0';
+
+  return n == BASELINE_RECORD;
+}
+
+static void
+baseline_write (int fd, int record, char *buf, const char *path)
+{
+  size_t len = strlen (buf);
+
+  memset (buf + len, ' ', BASELINE_RECORD - len);
+  buf[BASELINE_RECORD - 1] = '\n';
+
+  if (pwrite (fd, buf, BASELINE_RECORD, (off_t) record * BASELINE_RECORD)
+      != BASELINE_RECORD)
+    die (STATE_UNKNOWN, "Cannot write %s: %s\n", path, strerror (errno));
+}
+
+static int
+baseline_parse (const char *buf, double *updated, int *weeks,
+		double *mean, double *var)
+{
+  const char *p = buf;
+  char *end;
+  int i, n;
+
+  if (sscanf (p, "%lf %d%n", updated, weeks, &n) != 2 || *weeks <= 0)
+    return FALSE;
+
+  for (p += n, i = 0; i < BASELINE_METRICS; i++)
+    {
+      mean[i] = strtod (p, &end);
+      if (end == p)
+	return FALSE;
+      var[i] = strtod (p = end, &end);
+      if (end == p || var[i] < 0)
+	return FALSE;
+      p = end;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Compare the 'values' with the baseline of the current hour of the week,
+ * and add them to it
+ */
+void
+baseline_update (baseline *b, const char *name, const double *values)
+{
+  char *path, buf[BASELINE_RECORD + 1];
+  double mean[BASELINE_METRICS], var[BASELINE_METRICS];
+  double last, updated, elapsed, alpha, diff, incr, value;
+  time_t now = time (NULL);
+  struct tm tm;
+  int fd, i, len, weeks;
+
+  if (asprintf (&path, "%s/%s.%u", STATE_DIR, name,
+		(unsigned int) getuid ()) < 0)
+    die (STATE_UNKNOWN, "Error getting the state file name\n");
+
+  if ((fd = state_file_open (path, O_RDWR | O_CREAT, 0600)) < 0)
+    die (STATE_UNKNOWN, "Cannot open %s: %s\n", path, strerror (errno));
+  if (flock (fd, LOCK_EX) < 0)
+    die (STATE_UNKNOWN, "Cannot lock %s: %s\n", path, strerror (errno));
+
+  /* not a baseline file (or a truncated one): start from scratch */
+  if (!baseline_read (fd, 0, buf) || sscanf (buf, "baseline %lf", &last) != 1)
+    {
+      last = 0;
+      if (ftruncate (fd, 0) < 0 ||
+	  ftruncate (fd, (1 + BASELINE_SLOTS) * BASELINE_RECORD) < 0)
+	die (STATE_UNKNOWN, "Cannot write %s: %s\n", path, strerror (errno));
+    }
+
+  localtime_r (&now, &tm);
+  b->slot = tm.tm_wday * 24 + tm.tm_hour;
+
+  if (!baseline_read (fd, 1 + b->slot, buf) ||
+      !baseline_parse (buf, &updated, &weeks, mean, var))
+    weeks = 0;
+
+  /* the first run of this hour in the current week */
+  b->weeks = weeks;
+  if (weeks == 0 || now - updated >= BASELINE_SLOT_SECONDS)
+    b->weeks++;
+  b->ready = (b->weeks > BASELINE_MIN_WEEKS);
+
+  /* the samples of an hour weigh BASELINE_WEIGHT overall, whatever the
+   * interval between the runs
+   */
+  elapsed = now - last;
+  if (last == 0 || elapsed <= 0)
+    elapsed = BASELINE_INTERVAL;
+  if (elapsed > BASELINE_SLOT_SECONDS)
+    elapsed = BASELINE_SLOT_SECONDS;
+  alpha = BASELINE_WEIGHT * elapsed / BASELINE_SLOT_SECONDS;
+
+  len = snprintf (buf, sizeof buf, "%10ld %3d", (long) now,
+		  b->weeks < 999 ? b->weeks : 999);
+  for (i = 0; i < BASELINE_METRICS; i++)
+    {
+      value = values[i] < 0 ? 0 : values[i] > 100 ? 100 : values[i];
+
+      if (weeks == 0)
+	{
+	  mean[i] = value;
+	  var[i] = 0;
+	}
+
+      b->mean[i] = mean[i];
+      b->stddev[i] = sqrt (var[i]);
+      b->deviation[i] = (value - mean[i]) /
+	(b->stddev[i] > BASELINE_MIN_STDDEV ?
+	 b->stddev[i] : BASELINE_MIN_STDDEV);
+
+      /* the incremental EWMA of the mean and the variance */
+      diff = value - mean[i];
+      incr = alpha * diff;
+      mean[i] += incr;
+      var[i] = (1 - alpha) * (var[i] + diff * incr);
+
+      len += snprintf (buf + len, sizeof buf - len, " %8.4f %10.4f",
+		       mean[i], var[i]);
+    }
+
+  baseline_write (fd, 1 + b->slot, buf, path);
+  snprintf (buf, sizeof buf, "baseline %ld", (long) now);
+  baseline_write (fd, 0, buf, path);
+
+  close (fd);
+  free (path);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/* The usual value of some metrics at each hour of the week (an EWMA of
+ * their mean and variance), kept in a state file of fixed size and used
+ * for detecting the deviations from the weekly pattern.
+ */
+
+#define BASELINE_METRICS 2	/* memory and swap used, in percent */
+#define BASELINE_MIN_WEEKS 2	/* weeks of history before the deviations */
+
+typedef struct baseline_struct
+{
+  int slot;			/* hour of the week, 0 is Sunday 00:00 */
+  int weeks;			/* weeks of history of the slot */
+  int ready;			/* enough weeks for the deviations */
+  double mean[BASELINE_METRICS];
+  double stddev[BASELINE_METRICS];
+  double deviation[BASELINE_METRICS];	/* in standard deviations */
+} baseline;
+
+void baseline_update (baseline *, const char *, const double *);
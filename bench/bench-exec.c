@@ -0,0 +1,114 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Benchmark of the end-to-end execution time of a plugin
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nputils.h"
+
+static const char *program_name = "bench-exec";
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* The nearest-rank percentile 'p' of the sorted 'samples' */
+static double
+percentile (const double *samples, long count, int p)
+{
+  long rank = (count * p + 99) / 100;
+  return samples[rank > 0 ? rank - 1 : 0];
+}
+
+/* Run the command 'argv' and returns its execution time in us */
+static double
+run (char **argv)
+{
+  double start = now ();
+  int devnull, status;
+  pid_t pid;
+
+  if ((pid = fork ()) < 0)
+    die (STATE_UNKNOWN, "Cannot fork: %s\n", strerror (errno));
+  if (pid == 0)
+    {
+      if ((devnull = open ("/dev/null", O_WRONLY)) >= 0)
+	dup2 (devnull, STDOUT_FILENO);
+      execv (argv[0], argv);
+      _exit (127);
+    }
+
+  if (waitpid (pid, &status, 0) < 0)
+    die (STATE_UNKNOWN, "Cannot wait for %s: %s\n", argv[0], strerror (errno));
+  if (!WIFEXITED (status) || WEXITSTATUS (status) == 127)
+    die (STATE_UNKNOWN, "Cannot execute %s\n", argv[0]);
+
+  return now () - start;
+}
+
+int
+main (int argc, char **argv)
+{
+  double *samples;
+  long i, count;
+
+  if (argc < 3 || (count = atol (argv[1])) <= 0)
+    {
+      fprintf (stderr, "Usage: %s RUNS PLUGIN [ARGS...]\n", program_name);
+      return STATE_UNKNOWN;
+    }
+
+  if ((samples = malloc (count * sizeof (double))) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+
+  run (argv + 2);		/* warm up the page cache */
+  for (i = 0; i < count; i++)
+    samples[i] = run (argv + 2);
+  qsort (samples, count, sizeof (double), compare_doubles);
+
+  printf ("exec  %-16s p50 %8.0f us  p90 %8.0f us  p99 %8.0f us  max %8.0f us\n",
+	  strrchr (argv[2], '/') ? strrchr (argv[2], '/') + 1 : argv[2],
+	  percentile (samples, count, 50), percentile (samples, count, 90),
+	  percentile (samples, count, 99), samples[count - 1]);
+
+  free (samples);
+  return STATE_OK;
+}
@@ -0,0 +1,114 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Benchmark of the /proc parsers on a directory of recorded files
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "meminfo.h"
+#include "vminfo.h"
+
+/* the median of the rounds is reported, to filter out the noise */
+#define ROUNDS 9
+
+static const char *program_name = "bench-parse";
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* Returns the median time in ns of one call of 'parser' */
+static double
+bench (void (*parser) (void), long iterations)
+{
+  double rounds[ROUNDS], start;
+  long i;
+  int r;
+
+  parser ();			/* open the files and warm up the caches */
+
+  for (r = 0; r < ROUNDS; r++)
+    {
+      start = now ();
+      for (i = 0; i < iterations; i++)
+	parser ();
+      rounds[r] = (now () - start) / iterations;
+    }
+
+  qsort (rounds, ROUNDS, sizeof (double), compare_doubles);
+  return rounds[ROUNDS / 2];
+}
+
+static void
+parse_meminfo (void)
+{
+  meminfo (CACHE_IS_FREE);
+}
+
+static void
+parse_vminfo (void)
+{
+  vminfo ();
+}
+
+int
+main (int argc, char **argv)
+{
+  long iterations = 10000;
+  const char *name;
+
+  if (argc < 2 || argc > 3)
+    {
+      fprintf (stderr, "Usage: %s FIXTURE_DIR [ITERATIONS]\n", program_name);
+      return STATE_UNKNOWN;
+    }
+  if (argc == 3 && (iterations = atol (argv[2])) <= 0)
+    die (STATE_UNKNOWN, "Invalid number of iterations: %s\n", argv[2]);
+
+  /* the parsers are built with the paths relative to the fixture */
+  if (chdir (argv[1]) < 0)
+    die (STATE_UNKNOWN, "Cannot access %s: %s\n", argv[1], strerror (errno));
+
+  name = strrchr (argv[1], '/') ? strrchr (argv[1], '/') + 1 : argv[1];
+  printf ("parse %-16s meminfo %10.0f ns/snapshot\n", name,
+	  bench (parse_meminfo, iterations));
+  printf ("parse %-16s vminfo  %10.0f ns/snapshot\n", name,
+	  bench (parse_vminfo, iterations));
+
+  return STATE_OK;
+}
@@ -0,0 +1,598 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Stress harness measuring how long the plugins take to detect
+ * a memory (or swap) pressure crossing their thresholds
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "meminfo.h"
+
+/* The ground truth: the memory usage is sampled every SAMPLE_MS with the
+ * parser and the thresholds code of the plugins; the plugins are executed
+ * every check interval, like the monitoring server would do.
+ */
+#define SAMPLE_MS	10
+#define CHUNK		(1024 * 1024)
+#define COOLDOWN_MS	60000
+#define BASELINE_RUNS	10
+
+#define CGROUP_V2	"/sys/fs/cgroup"
+#define CGROUP_V1	"/sys/fs/cgroup/memory"
+
+static const char *program_name = "bench-pressure";
+
+enum pressure_type
+{
+  PRESSURE_ANON,
+  PRESSURE_CACHE,
+  PRESSURE_SHMEM,
+  PRESSURE_SWAP
+};
+
+static const char *pressure_names[] = { "anon", "cache", "shmem", "swap" };
+
+enum plugin_id
+{
+  PLUGIN_MEMORY,
+  PLUGIN_SWAP,
+  PLUGINS
+};
+
+static const char *plugin_names[PLUGINS] = { "check_memory", "check_swap" };
+
+/* the samples of a distribution */
+typedef struct samples_struct
+{
+  double *values;
+  long count, alloc;
+} samples;
+
+static samples latencies[PLUGINS][STATE_CRITICAL + 1];
+static samples runtimes[PLUGINS][2];	/* idle, under pressure */
+static long missed[PLUGINS][STATE_CRITICAL + 1];
+static long crossings[PLUGINS][STATE_CRITICAL + 1];
+
+static char cgroup_path[PATH_MAX];
+static char pressure_file[PATH_MAX];
+
+static void attribute_noreturn usage (FILE * out)
+{
+  fprintf (out, "Usage: %s [OPTIONS] [-- PLUGIN_ARGS...]\n\n", program_name);
+  fputs ("\
+Drive a controlled memory pressure inside a cgroup and measure how long\n\
+check_memory and check_swap take to detect the threshold crossings.\n\n\
+Options:\n\
+  -t, --type TYPE        the pressure: anon (the default), cache, shmem\n\
+                         or swap (anon memory above the cgroup limit)\n\
+  -C, --caches           count buffers and cached memory as free memory\n\
+  -a, --available        count MemAvailable as free memory\n\
+  -w, --warning PERC     check_memory warning threshold (80%)\n\
+  -c, --critical PERC    check_memory critical threshold (90%)\n\
+  -W, --swap-warning PERC   check_swap warning threshold (30%)\n\
+  -K, --swap-critical PERC  check_swap critical threshold (50%)\n\
+  -s, --size MiB         the pressure size (by default, what is needed to\n\
+                         go 5% over the critical threshold)\n\
+  -r, --rate MiB/s       the pressure ramp rate (256)\n\
+  -H, --hold SECONDS     how long the pressure is kept (5)\n\
+  -i, --interval MS      the check interval of the plugins (1000)\n\
+  -n, --rounds N         the number of pressure rounds (5)\n\
+  -d, --dir DIR          where the cache and shmem files are written\n\
+                         (/var/tmp and /dev/shm)\n\
+  -p, --plugins DIR      the directory of the plugins (.)\n\
+  -h, --help             display this help and exit\n\n\
+The PLUGIN_ARGS are added to the command line of both the plugins.\n", out);
+
+  exit (out == stderr ? STATE_UNKNOWN : STATE_OK);
+}
+
+static struct option const longopts[] = {
+  {(char *) "type", required_argument, NULL, 't'},
+  {(char *) "caches", no_argument, NULL, 'C'},
+  {(char *) "available", no_argument, NULL, 'a'},
+  {(char *) "warning", required_argument, NULL, 'w'},
+  {(char *) "critical", required_argument, NULL, 'c'},
+  {(char *) "swap-warning", required_argument, NULL, 'W'},
+  {(char *) "swap-critical", required_argument, NULL, 'K'},
+  {(char *) "size", required_argument, NULL, 's'},
+  {(char *) "rate", required_argument, NULL, 'r'},
+  {(char *) "hold", required_argument, NULL, 'H'},
+  {(char *) "interval", required_argument, NULL, 'i'},
+  {(char *) "rounds", required_argument, NULL, 'n'},
+  {(char *) "dir", required_argument, NULL, 'd'},
+  {(char *) "plugins", required_argument, NULL, 'p'},
+  {(char *) "help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
+
+static double
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+sleep_ms (double ms)
+{
+  struct timespec ts;
+
+  if (ms <= 0)
+    return;
+  ts.tv_sec = (time_t) (ms / 1000);
+  ts.tv_nsec = (long) ((ms - ts.tv_sec * 1000) * 1e6);
+  nanosleep (&ts, NULL);
+}
+
+static void
+samples_add (samples *s, double value)
+{
+  if (s->count == s->alloc)
+    {
+      s->alloc = s->alloc ? s->alloc * 2 : 64;
+      if ((s->values = realloc (s->values, s->alloc * sizeof (double))) == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+  s->values[s->count++] = value;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* The nearest-rank percentile 'p' of the samples 's' (sorted) */
+static double
+percentile (const samples *s, int p)
+{
+  long rank = (s->count * p + 99) / 100;
+  return s->values[rank > 0 ? rank - 1 : 0];
+}
+
+static void
+samples_print (const char *what, const char *name, const char *level,
+	       samples *s, const char *extra)
+{
+  printf ("%-8s %-12s %-8s n %4ld", what, name, level, s->count);
+  if (s->count > 0)
+    {
+      qsort (s->values, s->count, sizeof (double), compare_doubles);
+      printf ("  p50 %8.1f ms  p90 %8.1f ms  p99 %8.1f ms  max %8.1f ms",
+	      percentile (s, 50), percentile (s, 90), percentile (s, 99),
+	      s->values[s->count - 1]);
+    }
+  printf ("%s\n", extra);
+}
+
+/* Write 'value' to the cgroup file 'name', returns -1 on errors */
+static int
+cgroup_write (const char *name, const char *value)
+{
+  char path[PATH_MAX + 32];
+  int fd, ret;
+
+  snprintf (path, sizeof path, "%s/%s", cgroup_path, name);
+  if ((fd = open (path, O_WRONLY)) < 0)
+    return -1;
+  ret = write (fd, value, strlen (value));
+  close (fd);
+
+  return (ret < 0) ? -1 : 0;
+}
+
+/*
+ * Create the cgroup containing the pressure, limited to 'limit' bytes of
+ * memory (cgroup v2, or the v1 memory controller).  Returns 0 on success.
+ */
+static int
+cgroup_create (unsigned long long limit)
+{
+  char value[32];
+  int v2 = (access (CGROUP_V2 "/cgroup.controllers", F_OK) == 0);
+
+  snprintf (cgroup_path, sizeof cgroup_path, "%s/%s.%ld",
+	    v2 ? CGROUP_V2 : CGROUP_V1, program_name, (long) getpid ());
+  if (mkdir (cgroup_path, 0755) < 0)
+    {
+      cgroup_path[0] = '\0';
+      return -1;
+    }
+
+  snprintf (value, sizeof value, "%llu", limit);
+  if (cgroup_write (v2 ? "memory.max" : "memory.limit_in_bytes", value) < 0)
+    {
+      rmdir (cgroup_path);
+      cgroup_path[0] = '\0';
+      return -1;
+    }
+  if (v2)
+    cgroup_write ("memory.swap.max", "max");
+
+  return 0;
+}
+
+/*
+ * The pressure generator (a child process): allocate and touch 'size'
+ * bytes at 'rate' bytes per second, keep them for 'hold' seconds, then
+ * release them.
+ */
+static void attribute_noreturn
+pressure (enum pressure_type type, unsigned long long size, double rate,
+	  double hold)
+{
+  unsigned long long done;
+  double start = now_ms ();
+  char *chunk = NULL;
+  int fd = -1;
+
+  /* the cgroup v2 (and v1) interpret "0" as the writing process */
+  if (cgroup_path[0] && cgroup_write ("cgroup.procs", "0") < 0)
+    _exit (STATE_UNKNOWN);
+
+  if (type == PRESSURE_CACHE || type == PRESSURE_SHMEM)
+    {
+      if ((fd = open (pressure_file, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+	_exit (STATE_UNKNOWN);
+      if ((chunk = malloc (CHUNK)) == NULL)
+	_exit (STATE_UNKNOWN);
+      memset (chunk, 0x5a, CHUNK);
+    }
+
+  for (done = 0; done < size; done += CHUNK)
+    {
+      if (fd < 0)
+	{
+	  chunk = mmap (NULL, CHUNK, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	  if (chunk == MAP_FAILED)
+	    _exit (STATE_UNKNOWN);
+	  memset (chunk, 0x5a, CHUNK);
+	}
+      else if (write (fd, chunk, CHUNK) != CHUNK)
+	_exit (STATE_UNKNOWN);
+
+      sleep_ms (start + (done + CHUNK) * 1000.0 / rate - now_ms ());
+    }
+
+  sleep_ms (hold * 1000);
+
+  if (fd >= 0)
+    {
+      posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+      close (fd);
+      unlink (pressure_file);
+    }
+  _exit (STATE_OK);
+}
+
+/* Run the plugin 'argv', returns its state and its runtime in ms */
+static int
+plugin_run (char **argv, double *runtime)
+{
+  double start = now_ms ();
+  int devnull, status;
+  pid_t pid;
+
+  if ((pid = fork ()) < 0)
+    die (STATE_UNKNOWN, "Cannot fork: %s\n", strerror (errno));
+  if (pid == 0)
+    {
+      if ((devnull = open ("/dev/null", O_WRONLY)) >= 0)
+	dup2 (devnull, STDOUT_FILENO);
+      execv (argv[0], argv);
+      _exit (127);
+    }
+
+  if (waitpid (pid, &status, 0) < 0)
+    die (STATE_UNKNOWN, "Cannot wait for %s: %s\n", argv[0], strerror (errno));
+  if (!WIFEXITED (status) || WEXITSTATUS (status) == 127)
+    die (STATE_UNKNOWN, "Cannot execute %s\n", argv[0]);
+
+  *runtime = now_ms () - start;
+  return WEXITSTATUS (status);
+}
+
+/* The current usage, in percent, checked by the plugin 'id' */
+static double
+usage_percent (int id, int cache_is_free)
+{
+  meminfo (cache_is_free);
+  if (id == PLUGIN_MEMORY)
+    return kb_main_total ? kb_main_used * 100.0 / kb_main_total : 0;
+  return kb_swap_total ? kb_swap_used * 100.0 / kb_swap_total : 0;
+}
+
+/* Build the command line of the plugin 'name' */
+static char **
+plugin_argv (const char *dir, const char *name, const char *accounting,
+	     char *warning, char *critical, int argc, char **argv)
+{
+  char **args;
+  int i, n = 0;
+
+  if ((args = calloc (argc + 7, sizeof (char *))) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+  if (asprintf (&args[n++], "%s/%s", dir, name) < 0)
+    die (STATE_UNKNOWN, "Error getting the plugin path\n");
+  if (accounting)
+    args[n++] = (char *) accounting;
+  args[n++] = (char *) "-w";
+  args[n++] = warning;
+  args[n++] = (char *) "-c";
+  args[n++] = critical;
+  for (i = 0; i < argc; i++)
+    args[n++] = argv[i];
+
+  return args;
+}
+
+int
+main (int argc, char **argv)
+{
+  enum pressure_type type = PRESSURE_ANON;
+  int c, i, id, level, round, rounds = 5, state;
+  int cache_is_free = CACHE_IS_USED;
+  const char *accounting = NULL, *dir = NULL, *plugins_dir = ".";
+  char *warning[PLUGINS] = { (char *) "80%", (char *) "30%" };
+  char *critical[PLUGINS] = { (char *) "90%", (char *) "50%" };
+  thresholds *my_thresholds[PLUGINS];
+  char **plugin_args[PLUGINS];
+  double size = 0, rate = 256.0 * 1024 * 1024, hold = 5, interval = 1000;
+  double crossed[PLUGINS][STATE_CRITICAL + 1];
+  double detected[PLUGINS][STATE_CRITICAL + 1];
+  double start, next_check, runtime, limit, pct;
+  unsigned long long pressure_size;
+  pid_t child;
+
+  while ((c = getopt_long (argc, argv, "t:Caw:c:W:K:s:r:H:i:n:d:p:h",
+			   longopts, NULL)) != -1)
+    {
+      switch (c)
+	{
+	default:
+	  usage (stderr);
+	case 't':
+	  for (i = PRESSURE_ANON; i <= PRESSURE_SWAP; i++)
+	    if (!strcmp (optarg, pressure_names[i]))
+	      break;
+	  if (i > PRESSURE_SWAP)
+	    usage (stderr);
+	  type = i;
+	  break;
+	case 'C':
+	  cache_is_free = CACHE_IS_FREE;
+	  accounting = "-C";
+	  break;
+	case 'a':
+	  cache_is_free = AVAILABLE_IS_FREE;
+	  accounting = "-a";
+	  break;
+	case 'w': warning[PLUGIN_MEMORY] = optarg; break;
+	case 'c': critical[PLUGIN_MEMORY] = optarg; break;
+	case 'W': warning[PLUGIN_SWAP] = optarg; break;
+	case 'K': critical[PLUGIN_SWAP] = optarg; break;
+	case 's': size = atof (optarg) * 1024 * 1024; break;
+	case 'r': rate = atof (optarg) * 1024 * 1024; break;
+	case 'H': hold = atof (optarg); break;
+	case 'i': interval = atof (optarg); break;
+	case 'n': rounds = atoi (optarg); break;
+	case 'd': dir = optarg; break;
+	case 'p': plugins_dir = optarg; break;
+	case 'h':
+	  usage (stdout);
+	}
+    }
+  if (rounds < 1 || rate < CHUNK || interval < SAMPLE_MS || hold < 0)
+    usage (stderr);
+
+  for (id = 0; id < PLUGINS; id++)
+    {
+      if (set_thresholds (&my_thresholds[id], warning[id], critical[id]) ==
+	  NP_RANGE_UNPARSEABLE || !my_thresholds[id]->critical)
+	usage (stderr);
+      plugin_args[id] =
+	plugin_argv (plugins_dir, plugin_names[id],
+		     id == PLUGIN_MEMORY ? accounting : NULL,
+		     warning[id], critical[id], argc - optind, argv + optind);
+    }
+
+  /* by default, go 5% over the critical threshold */
+  meminfo (cache_is_free);
+  if (type == PRESSURE_SWAP)
+    {
+      if (kb_swap_total == 0)
+	die (STATE_UNKNOWN, "No swap space available\n");
+      if (size == 0)
+	size = (my_thresholds[PLUGIN_SWAP]->critical->end + 5) / 100 *
+	  kb_swap_total * 1024.0 - kb_swap_used * 1024.0;
+    }
+  else if (size == 0)
+    size = (my_thresholds[PLUGIN_MEMORY]->critical->end + 5) / 100 *
+      kb_main_total * 1024.0 - kb_main_used * 1024.0;
+  if (size < CHUNK)
+    die (STATE_UNKNOWN, "The critical threshold is already crossed\n");
+  pressure_size = (unsigned long long) size;
+
+  /* the swap pressure is the memory above the cgroup limit; otherwise
+   * the limit protects the host from a wrong size */
+  limit = (type == PRESSURE_SWAP) ? 64.0 * CHUNK : size + 64.0 * CHUNK;
+  if (cgroup_create ((unsigned long long) limit) < 0)
+    {
+      if (type == PRESSURE_SWAP)
+	die (STATE_UNKNOWN, "Cannot create a memory cgroup: %s\n",
+	     strerror (errno));
+      fprintf (stderr, "%s: running without a memory cgroup: %s\n",
+	       program_name, strerror (errno));
+    }
+  if (type == PRESSURE_SWAP)
+    pressure_size += (unsigned long long) limit;
+
+  if (type == PRESSURE_CACHE || type == PRESSURE_SHMEM)
+    snprintf (pressure_file, sizeof pressure_file, "%s/%s.%ld",
+	      dir ? dir : (type == PRESSURE_CACHE ? "/var/tmp" : "/dev/shm"),
+	      program_name, (long) getpid ());
+
+  printf ("# %s: %s pressure of %.0f MiB at %.0f MiB/s, hold %.1f s, "
+	  "check interval %.0f ms, %d rounds, cgroup %s\n", program_name,
+	  pressure_names[type], pressure_size / 1048576.0, rate / 1048576,
+	  hold, interval, rounds, cgroup_path[0] ? cgroup_path : "none");
+
+  for (id = 0; id < PLUGINS; id++)
+    for (i = 0; i < BASELINE_RUNS; i++)
+      {
+	plugin_run (plugin_args[id], &runtime);
+	samples_add (&runtimes[id][0], runtime);
+      }
+
+  for (round = 1; round <= rounds; round++)
+    {
+      memset (crossed, 0, sizeof crossed);
+      memset (detected, 0, sizeof detected);
+
+      fflush (NULL);
+      if ((child = fork ()) < 0)
+	die (STATE_UNKNOWN, "Cannot fork: %s\n", strerror (errno));
+      if (child == 0)
+	pressure (type, pressure_size, rate, hold);
+
+      start = next_check = now_ms ();
+      for (;;)
+	{
+	  /* the ground truth */
+	  for (id = 0; id < PLUGINS; id++)
+	    {
+	      pct = usage_percent (id, cache_is_free);
+	      state = get_status (pct, my_thresholds[id]);
+	      for (level = STATE_WARNING; level <= STATE_CRITICAL; level++)
+		if (state >= level && state <= STATE_CRITICAL &&
+		    !crossed[id][level])
+		  crossed[id][level] = now_ms ();
+	    }
+
+	  if (now_ms () >= next_check)
+	    {
+	      for (id = 0; id < PLUGINS; id++)
+		{
+		  state = plugin_run (plugin_args[id], &runtime);
+		  samples_add (&runtimes[id][child > 0], runtime);
+		  for (level = STATE_WARNING; level <= STATE_CRITICAL; level++)
+		    if (state >= level && state <= STATE_CRITICAL &&
+			!detected[id][level])
+		      {
+			detected[id][level] = now_ms ();
+			/* crossed between two samples */
+			if (!crossed[id][level])
+			  crossed[id][level] = detected[id][level];
+		      }
+		}
+	      next_check += interval;
+	    }
+
+	  if (child > 0 && waitpid (child, &state, WNOHANG) == child)
+	    {
+	      if (!WIFEXITED (state) || WEXITSTATUS (state) != STATE_OK)
+		fprintf (stderr, "%s: round %d: the pressure generator "
+			 "failed (killed by the OOM killer?)\n",
+			 program_name, round);
+	      if (pressure_file[0])
+		unlink (pressure_file);
+	      child = 0;
+	      start = now_ms ();
+	    }
+
+	  /* the pressure is over when both the plugins are back to OK */
+	  if (child == 0 &&
+	      (now_ms () - start > COOLDOWN_MS ||
+	       (get_status (usage_percent (PLUGIN_MEMORY, cache_is_free),
+			    my_thresholds[PLUGIN_MEMORY]) == STATE_OK &&
+		get_status (usage_percent (PLUGIN_SWAP, cache_is_free),
+			    my_thresholds[PLUGIN_SWAP]) == STATE_OK)))
+	    break;
+
+	  sleep_ms (SAMPLE_MS);
+	}
+
+      printf ("round %d:", round);
+      for (id = 0; id < PLUGINS; id++)
+	for (level = STATE_WARNING; level <= STATE_CRITICAL; level++)
+	  {
+	    if (!crossed[id][level])
+	      continue;
+	    crossings[id][level]++;
+	    if (detected[id][level])
+	      {
+		samples_add (&latencies[id][level],
+			     detected[id][level] - crossed[id][level]);
+		printf (" %s %s %.0f ms", plugin_names[id], state_text (level),
+			detected[id][level] - crossed[id][level]);
+	      }
+	    else
+	      {
+		missed[id][level]++;
+		printf (" %s %s missed", plugin_names[id], state_text (level));
+	      }
+	  }
+      printf ("\n");
+    }
+
+  if (cgroup_path[0])
+    rmdir (cgroup_path);
+
+  for (id = 0; id < PLUGINS; id++)
+    for (level = STATE_WARNING; level <= STATE_CRITICAL; level++)
+      {
+	char extra[64];
+
+	snprintf (extra, sizeof extra, "  crossed %ld missed %ld",
+		  crossings[id][level], missed[id][level]);
+	samples_print ("latency", plugin_names[id], state_text (level),
+		       &latencies[id][level], extra);
+      }
+  for (id = 0; id < PLUGINS; id++)
+    {
+      samples_print ("runtime", plugin_names[id], "idle", &runtimes[id][0], "");
+      samples_print ("runtime", plugin_names[id], "pressure",
+		     &runtimes[id][1], "");
+    }
+
+  return STATE_OK;
+}
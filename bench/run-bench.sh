@@ -0,0 +1,25 @@
+#!/bin/sh
+# Run the benchmarks of the plugins ('make bench').
+#
+# Usage: run-bench.sh FIXTURES_DIR
+#
+# The parsers are benchmarked on each directory of /proc files recorded
+# in FIXTURES_DIR; the plugins are executed on the running system.
+# The environment variables BENCH_ITERATIONS and BENCH_RUNS set the
+# number of parser calls per round and of plugin executions.
+#
+# The output has a stable format, one measure per line, so that the
+# results of two commits can be compared with diff or a spreadsheet.
+
+fixtures="${1:-bench/fixtures}"
+iterations="${BENCH_ITERATIONS:-10000}"
+runs="${BENCH_RUNS:-200}"
+
+echo "# $(uname -sr) $(uname -m), $(date -u '+%Y-%m-%d %H:%M:%S UTC')"
+
+for dir in "$fixtures"/*/; do
+  ./bench-parse "${dir%/}" "$iterations" || exit $?
+done
+
+./bench-exec "$runs" ./check_memory -C -w 90 -c 95 || exit $?
+./bench-exec "$runs" ./check_swap -w 50 -c 75 || exit $?
@@ -22,13 +22,32 @@
 
 #include "config.h"
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
 #include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "nputils.h"
+#include "baseline.h"
 #include "meminfo.h"
+#include "metrics.h"
+#include "passive.h"
+#include "profile.h"
+#ifdef HAVE_LINUX_PROCFS
+# include "replay.h"
+# include "sampler.h"
+# include "vminfo.h"
+#endif
+
+/* in the multi-call binary (see multicall.c) */
+#ifdef MULTICALL
+# define main check_memory_main
+#endif
 
 static const char *program_name = "check_memory";
 static const char *program_version = PACKAGE_VERSION;
@@ -42,21 +61,165 @@ static void attribute_noreturn usage (FILE * out)
            program_name, program_version);
   fprintf (out, "%s\n\n", program_copyright);
   fprintf (out,
-           "Usage: %s [-b,-k,-m,-g] [-C] -w PERC -c PERC\n",
+           "Usage: %s [-b,-k,-m,-g] [-C|-a] -w PERC -c PERC\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] [-C|-a] -w EXPR -c EXPR\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] [-C|-a] --baseline "
+           "-w SIGMA -c SIGMA\n", program_name);
+#ifdef HAVE_LINUX_PROCFS
+  fprintf (out, "       %s [-b,-k,-m,-g] [-C|-a] --peak -w PERC -c PERC\n",
+           program_name);
+  fprintf (out, "       %s --sampler MSEC\n", program_name);
+  fprintf (out,
+           "       %s [-C] --thrashing -w PERC,REFAULT,ACTIVATE "
+           "-c PERC,REFAULT,ACTIVATE\n", program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --dirty -w PERC -c PERC\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --commit -w PERC -c PERC\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --breakdown -w PERC -c PERC\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --slab -w PERC,GROWTH "
+           "-c PERC,GROWTH\n", program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --ksm -w SAVED,USED -c SAVED,USED\n",
            program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --leaks [--pss] "
+           "-w GROWTH -c GROWTH\n", program_name);
+  fprintf (out,
+           "       %s --reclaim -w DIRECT,EFF,MAJFLT -c DIRECT,EFF,MAJFLT\n",
+           program_name);
+  fprintf (out, "       %s --oom [-w KILLS,EVENTS] [-c KILLS,EVENTS]\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --shmem -w PERC -c PERC\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --sockets [-w PERC] [-c PERC]\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] [-C|-a] --replay PATH "
+           "-w PERC -c PERC\n", program_name);
+#endif
   fprintf (out, "       %s -h\n", program_name);
   fprintf (out, "       %s -V\n\n", program_name);
   fputs ("\
 Options:\n\
   -b,-k,-m,-g      show output in bytes, KB (the default), MB, or GB\n\
   -C, --caches     count buffers and cached memory as free memory\n\
+                   (tmpfs and shared memory excluded)\n\
+  -a, --available  count as free the memory available for starting new\n\
+                   applications without swapping (MemAvailable on linux)\n\
   -w, --warning PERCENT   warning threshold\n\
   -c, --critical PERCENT   critical threshold\n\
+                   the thresholds can also be expressions over the metrics,\n\
+                   like 'swap_used_pct > 50 && pswpin_rate > 200' (both\n\
+                   of them: a range and an expression cannot be mixed)\n\
+  --baseline       check the deviation of the memory and swap usage from\n\
+                   their usual value at the current hour of the week (an\n\
+                   average of the previous weeks, kept in the state\n\
+                   directory); the thresholds are in standard deviations\n\
+                   above the baseline, and apply after two weeks of runs\n\
+  --output FORMAT  the output format: nagios (the default), json or\n\
+                   openmetrics (the sizes in bytes)\n\
+  --textfile PATH  also write the metrics in the OpenMetrics format to PATH,\n\
+                   atomically (for the node_exporter textfile collector)\n\
+  --self-profile   add to the perfdata the time spent reading the /proc and\n\
+                   /sys files, parsing them and formatting the output, the\n\
+                   bytes read and the page faults of the plugin\n\
+  --passive DEST   also submit the result as a passive check to DEST: the\n\
+                   Nagios checkresults directory, or the external command\n\
+                   file\n\
+  --host NAME      the host of the passive check (the local host name by\n\
+                   default)\n\
+  --service DESC   the service of the passive check, and of the window of\n\
+                   --peak (default: check_memory)\n\
+  --batch COUNT[,SECONDS]  queue the passive check results, and submit\n\
+                   them COUNT at a time or when the oldest is SECONDS old;\n\
+                   a result with the state of the queued one replaces it,\n\
+                   and a state change is submitted at once\n\
   -h, --help       display this help and exit\n\
-  -v, --version    output version information and exit\n\n", out);
-  fprintf (out, "\
+  -v, --version    output version information and exit\n", out);
+#ifdef HAVE_LINUX_PROCFS
+  fputs ("\
+  --peak           check the peak of the memory used since the previous\n\
+                   run (at most the last hour), recorded by the sampler,\n\
+                   instead of the current value\n\
+  --sampler MSEC   run in the foreground as the sampler of --peak (and of\n\
+                   check_swap --peak), reading the memory and swap usage\n\
+                   every MSEC milliseconds; it must run as the user of\n\
+                   the plugins\n\
+  --reclaim        check the page reclaim activity since the previous run:\n\
+                   the direct reclaim stalls per second, the percentage of\n\
+                   the scanned pages actually reclaimed and the major page\n\
+                   faults per second\n\
+  --thrashing      also check the page cache refaults since the previous run,\n\
+                   as a percentage of the page cache refaulted per minute:\n\
+                   all the refaults, and the ones of the workingset pages\n\
+  --dirty          check the dirty and writeback memory, as percentage of\n\
+                   the dirty limit (vm.dirty_ratio or vm.dirty_bytes)\n\
+  --commit         check the committed memory (Committed_AS), as percentage\n\
+                   of the commit limit; always OK when the limit is not\n\
+                   enforced (vm.overcommit_memory != 2)\n\
+  --breakdown      split the memory in anon, file, shmem, slab, kernel,\n\
+                   hugetlb, unevictable and free, and check the memory not\n\
+                   accounted by the kernel (usually driver allocations)\n\
+  --slab           report the biggest slab caches, and check the\n\
+                   unreclaimable slab (percentage of the memory, and\n\
+                   growth in kB per hour since the previous run)\n\
+  --ksm            check the memory saved by KSM (percentage of the memory)\n\
+                   when the memory used (MemAvailable accounting) is high:\n\
+                   an alert is raised when both the ranges are matched\n\
+  --leaks          check the processes with a sustained memory growth:\n\
+                   the RSS of each process is sampled every 5 minutes (at\n\
+                   most), and the growth fitted over the last 2 hours; the\n\
+                   thresholds apply to the fastest growth, in kB per hour\n\
+  --pss            with --leaks, sample the PSS instead of the RSS (kernel\n\
+                   4.14+, the processes not readable are skipped)\n\
+  --oom            check the processes killed by the OOM killer, and the\n\
+                   memory.max and memory.high events of the memory cgroups\n\
+                   (v2) since the previous run, naming the cgroups; by\n\
+                   default any OOM kill is critical and any event a warning\n\
+  --shmem          check the shared memory (Shmem) as percentage of the\n\
+                   memory, and report the biggest consumers: the tmpfs\n\
+                   mounts, the SysV segments, the memfd files and the\n\
+                   deleted tmpfs files still open (of all the processes\n\
+                   when run by root)\n\
+  --sockets        check the memory of the TCP and UDP socket buffers, as\n\
+                   percentage of the net.ipv4.tcp_mem and udp_mem max\n\
+                   limits, and report the orphaned and time-wait sockets;\n\
+                   by default the state is warning over the pressure\n\
+                   threshold and critical at the max limit\n\
+  --replay PATH    check the /proc/meminfo snapshots archived in the file\n\
+                   PATH (the snapshots can be concatenated) or in the files\n\
+                   of the directory PATH, in parallel on all the CPUs, and\n\
+                   print the status of each snapshot and a summary\n", out);
+#endif
+  fprintf (out, "\n\
 Examples:\n\
   %s -C -w 80%% -c90%%\n", program_name);
+  fprintf (out, "  %s -a -w 'mem_free < 2GiB' "
+           "-c 'mem_free < 1GiB || swap_used_pct > 50'\n", program_name);
+  fprintf (out, "  %s -a --baseline -w 3 -c 5\n", program_name);
+  fprintf (out, "  %s -a -w 80%% -c 90%% --passive "
+           "/var/spool/nagios/checkresults --batch 10,300\n", program_name);
+#ifdef HAVE_LINUX_PROCFS
+  fprintf (out, "  %s --sampler 250 &\n", program_name);
+  fprintf (out, "  %s -a --peak -w 80%% -c 90%%\n", program_name);
+  fprintf (out, "  %s -C --thrashing -w 80%%,50,10 -c 90%%,100,30\n",
+           program_name);
+  fprintf (out, "  %s --dirty -w 40%% -c 50%%\n", program_name);
+  fprintf (out, "  %s --commit -m -w 85%% -c 95%%\n", program_name);
+  fprintf (out, "  %s --breakdown -m -w 5%% -c 10%%\n", program_name);
+  fprintf (out, "  %s --slab -m -w 10%%,10240 -c 20%%,102400\n",
+           program_name);
+  fprintf (out, "  %s --ksm -w 10:,80 -c 5:,90\n", program_name);
+  fprintf (out, "  %s --leaks -m -w 10240 -c 102400\n", program_name);
+  fprintf (out, "  %s --reclaim -w 10,50:,100 -c 100,20:,1000\n",
+           program_name);
+  fprintf (out, "  %s --oom -w 0,100 -c 0\n", program_name);
+  fprintf (out, "  %s --shmem -m -w 20%% -c 30%%\n", program_name);
+  fprintf (out, "  %s --sockets -m -w 50%% -c 80%%\n", program_name);
+  fprintf (out, "  %s -a --replay /srv/snapshots/meminfo -w 80%% -c 90%%\n",
+           program_name);
+#endif
 
   exit (out == stderr ? STATE_UNKNOWN : STATE_OK);
 }
@@ -73,7 +236,61 @@ There is NO WARRANTY, to the extent permitted by law.\n", stdout);
   exit (STATE_OK);
 }
 
+enum
+{
+  RECLAIM_OPTION = CHAR_MAX + 1,
+  THRASHING_OPTION,
+  DIRTY_OPTION,
+  COMMIT_OPTION,
+  BREAKDOWN_OPTION,
+  SLAB_OPTION,
+  KSM_OPTION,
+  LEAKS_OPTION,
+  PSS_OPTION,
+  OOM_OPTION,
+  SHMEM_OPTION,
+  SOCKETS_OPTION,
+  OUTPUT_OPTION,
+  TEXTFILE_OPTION,
+  SELF_PROFILE_OPTION,
+  PASSIVE_OPTION,
+  HOST_OPTION,
+  SERVICE_OPTION,
+  BATCH_OPTION,
+  REPLAY_OPTION,
+  BASELINE_OPTION,
+  PEAK_OPTION,
+  SAMPLER_OPTION
+};
+
+enum check_mode
+{
+  CHECK_USAGE,
+  CHECK_EXPRESSION,
+  CHECK_BASELINE,
+  CHECK_RECLAIM,
+  CHECK_DIRTY,
+  CHECK_COMMIT,
+  CHECK_BREAKDOWN,
+  CHECK_SLAB,
+  CHECK_KSM,
+  CHECK_LEAKS,
+  CHECK_OOM,
+  CHECK_SHMEM,
+  CHECK_SOCKETS
+};
+
+/* A single check for each run: another mode option is an error */
+static enum check_mode
+set_mode (enum check_mode mode, enum check_mode new_mode)
+{
+  if (mode != CHECK_USAGE)
+    usage (stderr);
+  return new_mode;
+}
+
 static struct option const longopts[] = {
+  {(char *) "available", no_argument, NULL, 'a'},
   {(char *) "caches", no_argument, NULL, 'C'},
   {(char *) "critical", required_argument, NULL, 'c'},
   {(char *) "warning", required_argument, NULL, 'w'},
@@ -83,30 +300,547 @@ static struct option const longopts[] = {
   {(char *) "gigabyte", no_argument, NULL, 'g'},
   {(char *) "help", no_argument, NULL, 'h'},
   {(char *) "version", no_argument, NULL, 'V'},
+  {(char *) "output", required_argument, NULL, OUTPUT_OPTION},
+  {(char *) "textfile", required_argument, NULL, TEXTFILE_OPTION},
+  {(char *) "self-profile", no_argument, NULL, SELF_PROFILE_OPTION},
+  {(char *) "passive", required_argument, NULL, PASSIVE_OPTION},
+  {(char *) "host", required_argument, NULL, HOST_OPTION},
+  {(char *) "service", required_argument, NULL, SERVICE_OPTION},
+  {(char *) "batch", required_argument, NULL, BATCH_OPTION},
+  {(char *) "baseline", no_argument, NULL, BASELINE_OPTION},
+#ifdef HAVE_LINUX_PROCFS
+  {(char *) "reclaim", no_argument, NULL, RECLAIM_OPTION},
+  {(char *) "thrashing", no_argument, NULL, THRASHING_OPTION},
+  {(char *) "dirty", no_argument, NULL, DIRTY_OPTION},
+  {(char *) "commit", no_argument, NULL, COMMIT_OPTION},
+  {(char *) "breakdown", no_argument, NULL, BREAKDOWN_OPTION},
+  {(char *) "slab", no_argument, NULL, SLAB_OPTION},
+  {(char *) "ksm", no_argument, NULL, KSM_OPTION},
+  {(char *) "leaks", no_argument, NULL, LEAKS_OPTION},
+  {(char *) "pss", no_argument, NULL, PSS_OPTION},
+  {(char *) "oom", no_argument, NULL, OOM_OPTION},
+  {(char *) "shmem", no_argument, NULL, SHMEM_OPTION},
+  {(char *) "sockets", no_argument, NULL, SOCKETS_OPTION},
+  {(char *) "replay", required_argument, NULL, REPLAY_OPTION},
+  {(char *) "peak", no_argument, NULL, PEAK_OPTION},
+  {(char *) "sampler", required_argument, NULL, SAMPLER_OPTION},
+#endif
   {NULL, 0, NULL, 0}
 };
 
+static int
+check_usage (int cache_is_free, int thrashing, int peak, const char *service,
+             int shift, const char *units, char *warning, char *critical,
+             char **status_msg, perfdata *pd)
+{
+  thresholds *my_thresholds[3];
+  float percent_used = 0, percent_checked;
+  int i, status;
+#ifdef HAVE_LINUX_PROCFS
+  /* a window for each accounting, indexed by 'cache_is_free' */
+  static const char *peak_state[] = {
+    "check_memory_peak", "check_memory_peak_caches",
+    "check_memory_peak_available"
+  };
+  sampler_window window;
+  double peak_used;
+#endif
+
+  if (thrashing)
+    status = set_thresholds_list (my_thresholds, 3, warning, critical);
+  else
+    status = set_thresholds (&my_thresholds[0], warning, critical);
+  if (status == NP_RANGE_UNPARSEABLE)
+    usage (stderr);
+
+  meminfo (cache_is_free);
+
+  if (kb_main_total != 0)
+    percent_used = (kb_main_used * 100.0 / kb_main_total);
+  percent_checked = percent_used;
+
+#ifdef HAVE_LINUX_PROCFS
+  /* a spike between two runs can push the host into reclaim, and be gone
+   * when the plugin runs
+   */
+  if (peak && sampler_peak (peak_state[cache_is_free], service, &window) &&
+      kb_main_total != 0)
+    {
+      peak_used = window.max[SAMPLER_MEM_USED + cache_is_free];
+      if (peak_used * 100.0 / kb_main_total > percent_checked)
+        percent_checked = peak_used * 100.0 / kb_main_total;
+    }
+#endif
+
+  status = get_status (percent_checked, my_thresholds[0]);
+
+#ifdef HAVE_LINUX_PROCFS
+  /* a thrashing page cache can make the host I/O bound even when there
+   * is plenty of free memory
+   */
+  if (thrashing)
+    {
+      thrashinginfo ();
+      status = max_state (status,
+                          get_status (thrashing_refault, my_thresholds[1]));
+      status = max_state (status,
+                          get_status (thrashing_activate, my_thresholds[2]));
+    }
+#endif
+
+  *status_msg = get_memory_status (status, percent_used, shift, units);
+  get_memory_perfdata (pd);
+
+#ifdef HAVE_LINUX_PROCFS
+  if (thrashing)
+    {
+      *status_msg = append_msg (*status_msg, get_thrashing_status ());
+      get_thrashing_perfdata (pd);
+    }
+  if (peak)
+    {
+      i = SAMPLER_MEM_USED + cache_is_free;
+      *status_msg = append_msg (*status_msg,
+                                get_sampler_status (&window, i, kb_main_total,
+                                                    shift, units));
+      get_sampler_perfdata (pd, &window, i, "mem_used");
+    }
+#endif
+
+  for (i = 0; i < (thrashing ? 3 : 1); i++)
+    free (my_thresholds[i]);
+
+  return status;
+}
+
+static int
+check_expression (int cache_is_free, int shift, const char *units,
+                  char *warning, char *critical,
+                  char **status_msg, perfdata *pd)
+{
+  expression warn_expr, crit_expr;
+  float percent_used = 0;
+  int status;
+
+  metrics_compile (&warn_expr, warning);
+  metrics_compile (&crit_expr, critical);
+
+  metricsinfo (cache_is_free, &warn_expr, &crit_expr);
+  status = get_metrics_state (&warn_expr, &crit_expr);
+
+  if (kb_main_total != 0)
+    percent_used = (kb_main_used * 100.0 / kb_main_total);
+
+  *status_msg = append_msg (get_memory_status (status, percent_used,
+                                               shift, units),
+                            get_metrics_status (status,
+                                                &warn_expr, &crit_expr));
+  get_memory_perfdata (pd);
+  get_metrics_perfdata (pd, &warn_expr, &crit_expr);
+
+  return status;
+}
+
+static int
+check_baseline (int cache_is_free, int shift, const char *units,
+                char *warning, char *critical,
+                char **status_msg, perfdata *pd)
+{
+  /* a baseline for each accounting of the reclaimable memory */
+  static const char *baseline_names[] = {
+    [CACHE_IS_USED] = "check_memory_baseline",
+    [CACHE_IS_FREE] = "check_memory_baseline_caches",
+    [AVAILABLE_IS_FREE] = "check_memory_baseline_available"
+  };
+  static const char *labels[BASELINE_METRICS] = { "mem", "swap" };
+  thresholds *my_threshold = NULL;
+  double values[BASELINE_METRICS] = { 0, 0 };
+  char *msg;
+  baseline b;
+  int i, ret, status = STATE_OK;
+
+  if (set_thresholds (&my_threshold, warning, critical) != 0)
+    usage (stderr);
+
+  /* on linux swapinfo () reads the memory with the default accounting */
+  swapinfo ();
+  meminfo (cache_is_free);
+
+  if (kb_main_total != 0)
+    values[0] = kb_main_used * 100.0 / kb_main_total;
+  if (kb_swap_total != 0)
+    values[1] = kb_swap_used * 100.0 / kb_swap_total;
+
+  baseline_update (&b, baseline_names[cache_is_free], values);
+
+  /* a usage below the baseline is not an anomaly */
+  if (b.ready)
+    for (i = 0; i < BASELINE_METRICS; i++)
+      status = max_state (status,
+                          get_status (b.deviation[i] > 0 ? b.deviation[i] : 0,
+                                      my_threshold));
+  free (my_threshold);
+
+  *status_msg = get_memory_status (status, values[0], shift, units);
+  if (!b.ready)
+    {
+      if (asprintf (&msg, "learning the baseline of this hour of the week "
+                    "(%d of %d weeks)", b.weeks - 1, BASELINE_MIN_WEEKS) < 0)
+        die (STATE_UNKNOWN, "Error getting baseline status\n");
+      *status_msg = append_msg (*status_msg, msg);
+    }
+  else
+    for (i = 0; i < BASELINE_METRICS; i++)
+      {
+        if (i == 0)
+          ret = asprintf (&msg, "baseline %.2f%% +/- %.2f (%+.1f sigma)",
+                          b.mean[i], b.stddev[i], b.deviation[i]);
+        else
+          ret = asprintf (&msg, "%s %.2f%% used, baseline %.2f%% +/- %.2f "
+                          "(%+.1f sigma)", labels[i], values[i], b.mean[i],
+                          b.stddev[i], b.deviation[i]);
+        if (ret < 0)
+          die (STATE_UNKNOWN, "Error getting baseline status\n");
+        *status_msg = append_msg (*status_msg, msg);
+      }
+
+  get_memory_perfdata (pd);
+  for (i = 0; i < BASELINE_METRICS; i++)
+    {
+      perfdata_addf (pd, PERFDATA_PERCENT, values[i], "%s_used_pct",
+                     labels[i]);
+      if (!b.ready)
+        continue;
+      perfdata_addf (pd, PERFDATA_PERCENT, b.mean[i], "%s_baseline_pct",
+                     labels[i]);
+      perfdata_addf (pd, PERFDATA_NONE, b.deviation[i], "%s_deviation",
+                     labels[i]);
+    }
+
+  return status;
+}
+
+#ifdef HAVE_LINUX_PROCFS
+static int
+check_reclaim (char *warning, char *critical,
+               char **status_msg, perfdata *pd)
+{
+  thresholds *my_thresholds[3];
+  double values[3];
+  int i, status = STATE_OK;
+
+  if (set_thresholds_list (my_thresholds, 3, warning, critical) != 0)
+    usage (stderr);
+
+  reclaiminfo ();
+
+  values[0] = reclaim_direct_rate;
+  values[1] = reclaim_efficiency;
+  values[2] = reclaim_majfault_rate;
+
+  for (i = 0; i < 3; i++)
+    {
+      status = max_state (status, get_status (values[i], my_thresholds[i]));
+      free (my_thresholds[i]);
+    }
+
+  *status_msg = get_reclaim_status (status);
+  get_reclaim_perfdata (pd);
+
+  return status;
+}
+
+static int
+check_dirty (int shift, const char *units, char *warning, char *critical,
+             char **status_msg, perfdata *pd)
+{
+  thresholds *my_threshold = NULL;
+  int status;
+
+  if (set_thresholds (&my_threshold, warning, critical) != 0)
+    usage (stderr);
+
+  meminfo (CACHE_IS_USED);
+  dirtyinfo ();
+
+  status = get_status (dirty_percent, my_threshold);
+  free (my_threshold);
+
+  *status_msg = get_dirty_status (status, shift, units);
+  get_dirty_perfdata (pd);
+
+  return status;
+}
+
+static int
+check_commit (int shift, const char *units, char *warning, char *critical,
+              char **status_msg, perfdata *pd)
+{
+  thresholds *my_threshold = NULL;
+  int status;
+
+  if (set_thresholds (&my_threshold, warning, critical) != 0)
+    usage (stderr);
+
+  commitinfo ();
+
+  /* the allocations can only fail with the strict overcommit accounting */
+  status = STATE_OK;
+  if (overcommit_memory == 2)
+    status = get_status (commit_percent, my_threshold);
+  free (my_threshold);
+
+  *status_msg = get_commit_status (status, shift, units);
+  get_commit_perfdata (pd);
+
+  return status;
+}
+
+static int
+check_breakdown (int shift, const char *units, char *warning, char *critical,
+                 char **status_msg, perfdata *pd)
+{
+  thresholds *my_threshold = NULL;
+  int status;
+
+  if (set_thresholds (&my_threshold, warning, critical) != 0)
+    usage (stderr);
+
+  breakdowninfo ();
+
+  status = get_status (unaccounted_percent, my_threshold);
+  free (my_threshold);
+
+  *status_msg = get_breakdown_status (status, shift, units);
+  get_breakdown_perfdata (pd);
+
+  return status;
+}
+
+static int
+check_slab (int shift, const char *units, char *warning, char *critical,
+            char **status_msg, perfdata *pd)
+{
+  thresholds *my_thresholds[2];
+  int status;
+
+  if (set_thresholds_list (my_thresholds, 2, warning, critical) != 0)
+    usage (stderr);
+
+  meminfo (CACHE_IS_USED);
+  slabinfo ();
+
+  status = get_status (slab_unreclaim_percent, my_thresholds[0]);
+  status = max_state (status,
+                      get_status (slab_unreclaim_growth, my_thresholds[1]));
+  free (my_thresholds[0]);
+  free (my_thresholds[1]);
+
+  *status_msg = get_slab_status (status, shift, units);
+  get_slab_perfdata (pd);
+
+  return status;
+}
+
+/* Both the ranges must be matched: a missing range is always matched */
+static int
+ksm_alert (range *saved_range, range *used_range,
+           float saved_percent, float used_percent)
+{
+  return (saved_range && check_range (saved_percent, saved_range) &&
+          (!used_range || check_range (used_percent, used_range)));
+}
+
+static int
+check_ksm (int shift, const char *units, char *warning, char *critical,
+           char **status_msg, perfdata *pd)
+{
+  thresholds *my_thresholds[2];
+  float percent_used = 0;
+  int status;
+
+  if (set_thresholds_list (my_thresholds, 2, warning, critical) != 0)
+    usage (stderr);
+
+  meminfo (AVAILABLE_IS_FREE);
+  ksminfo ();
+
+  if (kb_main_total != 0)
+    percent_used = (kb_main_used * 100.0 / kb_main_total);
+
+  /* low savings only matter when the memory is getting short */
+  if (ksm_alert (my_thresholds[0]->critical, my_thresholds[1]->critical,
+                 ksm_saved_percent, percent_used))
+    status = STATE_CRITICAL;
+  else if (ksm_alert (my_thresholds[0]->warning, my_thresholds[1]->warning,
+                      ksm_saved_percent, percent_used))
+    status = STATE_WARNING;
+  else
+    status = STATE_OK;
+
+  if (!ksm_available)
+    status = STATE_UNKNOWN;
+  free (my_thresholds[0]);
+  free (my_thresholds[1]);
+
+  *status_msg = get_ksm_status (status, percent_used, shift, units);
+  get_ksm_perfdata (pd);
+
+  return status;
+}
+
+static int
+check_leaks (int pss, int shift, const char *units, char *warning,
+             char *critical, char **status_msg, perfdata *pd)
+{
+  thresholds *my_threshold = NULL;
+  int status;
+
+  if (set_thresholds (&my_threshold, warning, critical) != 0)
+    usage (stderr);
+
+  leakinfo (pss);
+
+  status = get_status (leak_max_growth, my_threshold);
+  free (my_threshold);
+
+  *status_msg = get_leak_status (status, shift, units);
+  get_leak_perfdata (pd);
+
+  return status;
+}
+
+/* any OOM kill is critical, and any throttling event a warning, unless
+ * the thresholds are given
+ */
+static int
+check_oom (char *warning, char *critical, char **status_msg, perfdata *pd)
+{
+  char default_warning[] = "0,0", default_critical[] = "0";
+  thresholds *my_thresholds[2];
+  int status;
+
+  if (warning == NULL && critical == NULL)
+    {
+      warning = default_warning;
+      critical = default_critical;
+    }
+  if (set_thresholds_list (my_thresholds, 2, warning, critical) != 0)
+    usage (stderr);
+
+  oominfo ();
+
+  status = get_status (oom_kills, my_thresholds[0]);
+  status = max_state (status, get_status (oom_throttled, my_thresholds[1]));
+  free (my_thresholds[0]);
+  free (my_thresholds[1]);
+
+  *status_msg = get_oom_status (status);
+  get_oom_perfdata (pd);
+
+  return status;
+}
+
+static int
+check_shmem (int shift, const char *units, char *warning, char *critical,
+             char **status_msg, perfdata *pd)
+{
+  thresholds *my_threshold = NULL;
+  int status;
+
+  if (set_thresholds (&my_threshold, warning, critical) != 0)
+    usage (stderr);
+
+  meminfo (CACHE_IS_USED);
+  shmeminfo ();
+
+  status = get_status (shmem_percent, my_threshold);
+  free (my_threshold);
+
+  *status_msg = get_shmem_status (status, shift, units);
+  get_shmem_perfdata (pd);
+
+  return status;
+}
+
+static int
+check_sockets (int shift, const char *units, char *warning, char *critical,
+               char **status_msg, perfdata *pd)
+{
+  thresholds *my_threshold = NULL;
+  int status;
+
+  sockstatinfo ();
+
+  /* without thresholds, the limits enforced by the kernel */
+  if (warning == NULL && critical == NULL)
+    status = sockets_limit ? STATE_CRITICAL :
+      sockets_pressure ? STATE_WARNING : STATE_OK;
+  else
+    {
+      if (set_thresholds (&my_threshold, warning, critical) != 0)
+        usage (stderr);
+      status = get_status (sockets_tcp_percent > sockets_udp_percent ?
+                           sockets_tcp_percent : sockets_udp_percent,
+                           my_threshold);
+      free (my_threshold);
+    }
+
+  *status_msg = get_sockstat_status (status, shift, units);
+  get_sockstat_perfdata (pd);
+
+  return status;
+}
+
+static int
+check_replay (const char *path, int cache_is_free, int shift,
+              const char *units, char *warning, char *critical)
+{
+  thresholds *my_thresholds;
+  int status;
+
+  if (set_thresholds (&my_thresholds, warning, critical) ==
+      NP_RANGE_UNPARSEABLE)
+    usage (stderr);
+
+  status = replay (path, cache_is_free, my_thresholds, shift, units);
+  free (my_thresholds);
+
+  return status;
+}
+#endif
+
 int
 main (int argc, char **argv)
 {
   int c, status;
-  int cache_is_free = 0;
+  int cache_is_free = CACHE_IS_USED;
+  int thrashing = 0;
+  int pss = 0;
+  int peak = 0;
+  int sampler = 0;
   int shift = 10;
+  enum check_mode mode = CHECK_USAGE;
   char *critical = NULL, *warning = NULL;
   char *units = NULL;
+  char *textfile = NULL;
+  char *replay_path = NULL;
   char *status_msg;
-  char *perfdata_msg;
-  thresholds *my_threshold = NULL;
-  float percent_used = 0;
+  int output_format = PERFDATA_FORMAT_NAGIOS;
+  perfdata pd = { NULL, 0, 0 };
+  passive ps = { NULL, NULL, NULL, 1, 0 };
 
-  while ((c = getopt_long (argc, argv, "MSCc:w:bkmghV", longopts, NULL)) != -1)
+  while ((c = getopt_long (argc, argv, "MSCac:w:bkmghV", longopts, NULL)) != -1)
     {
       switch (c)
         {
         default:
           usage (stderr);
         case 'C':
-          cache_is_free = 1;
+          cache_is_free = CACHE_IS_FREE;
+          break;
+        case 'a':
+          cache_is_free = AVAILABLE_IS_FREE;
           break;
         case 'c':
           critical = optarg;
@@ -122,33 +856,205 @@ main (int argc, char **argv)
         case 'k': shift = 10; units = strdup ("kB"); break;
         case 'm': shift = 20; units = strdup ("MB"); break;
         case 'g': shift = 30; units = strdup ("GB"); break;
+        case OUTPUT_OPTION:
+          if ((output_format = perfdata_format_parse (optarg)) < 0)
+            usage (stderr);
+          break;
+        case TEXTFILE_OPTION:
+          textfile = optarg;
+          break;
+        case SELF_PROFILE_OPTION:
+          profile_enable ();
+          break;
+        case PASSIVE_OPTION:
+          ps.dest = optarg;
+          break;
+        case HOST_OPTION:
+          ps.host = optarg;
+          break;
+        case SERVICE_OPTION:
+          ps.service = optarg;
+          break;
+        case BATCH_OPTION:
+          if (passive_batch_parse (&ps, optarg) < 0)
+            usage (stderr);
+          break;
+        case BASELINE_OPTION:
+          mode = set_mode (mode, CHECK_BASELINE);
+          break;
+        case RECLAIM_OPTION:
+          mode = set_mode (mode, CHECK_RECLAIM);
+          break;
+        case DIRTY_OPTION:
+          mode = set_mode (mode, CHECK_DIRTY);
+          break;
+        case COMMIT_OPTION:
+          mode = set_mode (mode, CHECK_COMMIT);
+          break;
+        case BREAKDOWN_OPTION:
+          mode = set_mode (mode, CHECK_BREAKDOWN);
+          break;
+        case SLAB_OPTION:
+          mode = set_mode (mode, CHECK_SLAB);
+          break;
+        case KSM_OPTION:
+          mode = set_mode (mode, CHECK_KSM);
+          break;
+        case LEAKS_OPTION:
+          mode = set_mode (mode, CHECK_LEAKS);
+          break;
+        case PSS_OPTION:
+          pss = 1;
+          break;
+        case OOM_OPTION:
+          mode = set_mode (mode, CHECK_OOM);
+          break;
+        case SHMEM_OPTION:
+          mode = set_mode (mode, CHECK_SHMEM);
+          break;
+        case SOCKETS_OPTION:
+          mode = set_mode (mode, CHECK_SOCKETS);
+          break;
+        case THRASHING_OPTION:
+          thrashing = 1;
+          break;
+        case REPLAY_OPTION:
+          replay_path = optarg;
+          break;
+        case PEAK_OPTION:
+          peak = 1;
+          break;
+        case SAMPLER_OPTION:
+          if ((sampler = atoi (optarg)) <= 0)
+            usage (stderr);
+          break;
         }
     }
 
-  status = set_thresholds (&my_threshold, warning, critical);
-  if (status == NP_RANGE_UNPARSEABLE)
-    usage (stderr);
-
   /* output in kilobytes by default */
   if (units == NULL)
     units = strdup ("kB");
 
-  meminfo (cache_is_free);
+  if (ps.dest == NULL &&
+      (ps.host || (ps.service && !peak) || ps.batch_count != 1 ||
+       ps.batch_age))
+    usage (stderr);
+  if (ps.service == NULL)
+    ps.service = program_name;
 
-  if (kb_main_total != 0)
-    percent_used = (kb_main_used * 100.0 / kb_main_total);
+  if (pss && mode != CHECK_LEAKS)
+    usage (stderr);
+  if (thrashing && mode == CHECK_BASELINE)
+    usage (stderr);
 
-  status = get_status (percent_used, my_threshold);
-  free (my_threshold);
+  /* a range and an expression cannot be mixed */
+  if (expr_is_expression (warning) || expr_is_expression (critical))
+    {
+      if ((warning && !expr_is_expression (warning)) ||
+          (critical && !expr_is_expression (critical)))
+        usage (stderr);
+      if (mode != CHECK_USAGE || thrashing)
+        usage (stderr);
+      mode = CHECK_EXPRESSION;
+    }
+  if (peak && mode != CHECK_USAGE)
+    usage (stderr);
 
-  status_msg = get_memory_status (status, percent_used, shift, units);
-  perfdata_msg = get_memory_perfdata (shift, units);
+#ifdef HAVE_LINUX_PROCFS
+  /* the sampler never returns */
+  if (sampler)
+    {
+      if (mode != CHECK_USAGE || thrashing || peak || replay_path ||
+          textfile || profile_enabled || ps.dest)
+        usage (stderr);
+      sampler_run (sampler);
+    }
+
+  /* the replay prints the status of each snapshot, not a single result */
+  if (replay_path)
+    {
+      if (mode != CHECK_USAGE || thrashing || peak || textfile ||
+          profile_enabled || ps.dest ||
+          output_format != PERFDATA_FORMAT_NAGIOS)
+        usage (stderr);
+      status = check_replay (replay_path, cache_is_free, shift, units,
+                             warning, critical);
+      free (units);
+      return status;
+    }
+#endif
+
+  switch (mode)
+    {
+    default:
+      status = check_usage (cache_is_free, thrashing, peak, ps.service,
+                            shift, units, warning, critical,
+                            &status_msg, &pd);
+      break;
+    case CHECK_EXPRESSION:
+      status = check_expression (cache_is_free, shift, units,
+                                 warning, critical,
+                                 &status_msg, &pd);
+      break;
+    case CHECK_BASELINE:
+      status = check_baseline (cache_is_free, shift, units,
+                               warning, critical, &status_msg, &pd);
+      break;
+#ifdef HAVE_LINUX_PROCFS
+    case CHECK_RECLAIM:
+      status = check_reclaim (warning, critical, &status_msg, &pd);
+      break;
+    case CHECK_DIRTY:
+      status = check_dirty (shift, units, warning, critical,
+                            &status_msg, &pd);
+      break;
+    case CHECK_COMMIT:
+      status = check_commit (shift, units, warning, critical,
+                             &status_msg, &pd);
+      break;
+    case CHECK_BREAKDOWN:
+      status = check_breakdown (shift, units, warning, critical,
+                                &status_msg, &pd);
+      break;
+    case CHECK_SLAB:
+      status = check_slab (shift, units, warning, critical,
+                           &status_msg, &pd);
+      break;
+    case CHECK_KSM:
+      status = check_ksm (shift, units, warning, critical,
+                          &status_msg, &pd);
+      break;
+    case CHECK_LEAKS:
+      status = check_leaks (pss, shift, units, warning, critical,
+                            &status_msg, &pd);
+      break;
+    case CHECK_OOM:
+      status = check_oom (warning, critical, &status_msg, &pd);
+      break;
+    case CHECK_SHMEM:
+      status = check_shmem (shift, units, warning, critical,
+                            &status_msg, &pd);
+      break;
+    case CHECK_SOCKETS:
+      status = check_sockets (shift, units, warning, critical,
+                              &status_msg, &pd);
+      break;
+#endif
+    }
 
-  printf ("%s | %s\n", status_msg, perfdata_msg);
+  if (profile_enabled)
+    get_profile_perfdata (&pd, output_format, program_name, status,
+                          status_msg, shift, units);
+  if (textfile)
+    perfdata_textfile (textfile, program_name, status, &pd);
+  if (ps.dest)
+    passive_submit (&ps, status, status_msg, &pd, shift, units);
+  perfdata_print (stdout, output_format, program_name, status, status_msg,
+                  &pd, shift, units);
 
   free (units);
   free (status_msg);
-  free (perfdata_msg);
+  perfdata_free (&pd);
 
   return status;
 }
@@ -22,13 +22,31 @@
 
 #include "config.h"
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
 #include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "nputils.h"
 #include "meminfo.h"
+#include "metrics.h"
+#include "passive.h"
+#include "profile.h"
+#ifdef HAVE_LINUX_PROCFS
+# include "sampler.h"
+# include "swapdev.h"
+# include "vminfo.h"
+#endif
+
+/* in the multi-call binary (see multicall.c) */
+#ifdef MULTICALL
+# define main check_swap_main
+#endif
 
 static const char *program_name = "check_swap";
 static const char *program_version = PACKAGE_VERSION;
@@ -44,6 +62,17 @@ static void attribute_noreturn usage (FILE * out)
   fprintf (out,
            "Usage: %s [-b,-k,-m,-g] -w PERC -c PERC\n",
            program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] -w EXPR -c EXPR\n", program_name);
+#ifdef HAVE_LINUX_PROCFS
+  fprintf (out,
+           "       %s [-b,-k,-m,-g] --rates -w PERC,SWPIN,SWPOUT "
+           "-c PERC,SWPIN,SWPOUT\n", program_name);
+  fprintf (out,
+           "       %s [-b,-k,-m,-g] --devices [--rates] -w PERC -c PERC\n",
+           program_name);
+  fprintf (out, "       %s [-b,-k,-m,-g] --peak [--rates] -w PERC -c PERC\n",
+           program_name);
+#endif
   fprintf (out, "       %s -h\n", program_name);
   fprintf (out, "       %s -V\n\n", program_name);
   fputs ("\
@@ -51,11 +80,57 @@ Options:\n\
   -b,-k,-m,-g      show output in bytes, KB (the default), MB, or GB\n\
   -w, --warning PERCENT   warning threshold\n\
   -c, --critical PERCENT   critical threshold\n\
+                   the thresholds can also be expressions over the metrics,\n\
+                   like 'swap_used_pct > 50 && pswpin_rate > 200' (both\n\
+                   of them: a range and an expression cannot be mixed)\n\
+  --output FORMAT  the output format: nagios (the default), json or\n\
+                   openmetrics (the sizes in bytes)\n\
+  --textfile PATH  also write the metrics in the OpenMetrics format to PATH,\n\
+                   atomically (for the node_exporter textfile collector)\n\
+  --self-profile   add to the perfdata the time spent reading the /proc and\n\
+                   /sys files, parsing them and formatting the output, the\n\
+                   bytes read and the page faults of the plugin\n\
+  --passive DEST   also submit the result as a passive check to DEST: the\n\
+                   Nagios checkresults directory, or the external command\n\
+                   file\n\
+  --host NAME      the host of the passive check (the local host name by\n\
+                   default)\n\
+  --service DESC   the service of the passive check, and of the window of\n\
+                   --peak (default: check_swap)\n\
+  --batch COUNT[,SECONDS]  queue the passive check results, and submit\n\
+                   them COUNT at a time or when the oldest is SECONDS old;\n\
+                   a result with the state of the queued one replaces it,\n\
+                   and a state change is submitted at once\n\
   -h, --help       display this help and exit\n\
-  -v, --version    output version information and exit\n\n", out);
-  fprintf (out, "\
+  -v, --version    output version information and exit\n", out);
+#ifdef HAVE_LINUX_PROCFS
+  fputs ("\
+  --rates          also check the pages swapped in and out per second\n\
+                   since the previous run\n\
+  --devices        report the usage of each swap device, the compression\n\
+                   ratio of zram and zswap and the I/O latency of the disk\n\
+                   devices; the thresholds apply to the percentage of RAM\n\
+                   consumed by the compressed swap (zram and zswap)\n\
+  --peak           check the peak of the swap used (and with --rates of the\n\
+                   swap-in rate) since the previous run, at most the last\n\
+                   hour, recorded by 'check_memory --sampler' (not with\n\
+                   --devices)\n", out);
+#endif
+  fprintf (out, "\n\
 Examples:\n\
-  %s -w 30%% -c 50%%\n\n", program_name);
+  %s -w 30%% -c 50%%\n", program_name);
+  fprintf (out, "  %s -w 30%% -c 50%% --passive /var/lib/nagios/rw/nagios.cmd "
+           "--service swap\n", program_name);
+#ifdef HAVE_LINUX_PROCFS
+  fprintf (out, "  %s -w 'swap_used_pct > 30' "
+           "-c 'swap_used_pct > 50 && pswpin_rate > 200'\n", program_name);
+  fprintf (out, "  %s --rates -w 30%%,100,100 -c 50%%,1000,1000\n",
+           program_name);
+  fprintf (out, "  %s --devices -m -w 10%% -c 20%%\n", program_name);
+  fprintf (out, "  %s --peak --rates -w 30%%,100,100 -c 50%%,1000,1000\n",
+           program_name);
+#endif
+  fputs ("\n", out);
 
   exit (out == stderr ? STATE_UNKNOWN : STATE_OK);
 }
@@ -72,6 +147,20 @@ There is NO WARRANTY, to the extent permitted by law.\n", stdout);
   exit (STATE_OK);
 }
 
+enum
+{
+  RATES_OPTION = CHAR_MAX + 1,
+  DEVICES_OPTION,
+  PEAK_OPTION,
+  OUTPUT_OPTION,
+  TEXTFILE_OPTION,
+  SELF_PROFILE_OPTION,
+  PASSIVE_OPTION,
+  HOST_OPTION,
+  SERVICE_OPTION,
+  BATCH_OPTION
+};
+
 static struct option const longopts[] = {
   {(char *) "critical", required_argument, NULL, 'c'},
   {(char *) "warning", required_argument, NULL, 'w'},
@@ -81,20 +170,159 @@ static struct option const longopts[] = {
   {(char *) "gigabyte", no_argument, NULL, 'g'},
   {(char *) "help", no_argument, NULL, 'h'},
   {(char *) "version", no_argument, NULL, 'V'},
+  {(char *) "output", required_argument, NULL, OUTPUT_OPTION},
+  {(char *) "textfile", required_argument, NULL, TEXTFILE_OPTION},
+  {(char *) "self-profile", no_argument, NULL, SELF_PROFILE_OPTION},
+  {(char *) "passive", required_argument, NULL, PASSIVE_OPTION},
+  {(char *) "host", required_argument, NULL, HOST_OPTION},
+  {(char *) "service", required_argument, NULL, SERVICE_OPTION},
+  {(char *) "batch", required_argument, NULL, BATCH_OPTION},
+#ifdef HAVE_LINUX_PROCFS
+  {(char *) "rates", no_argument, NULL, RATES_OPTION},
+  {(char *) "devices", no_argument, NULL, DEVICES_OPTION},
+  {(char *) "peak", no_argument, NULL, PEAK_OPTION},
+#endif
   {NULL, 0, NULL, 0}
 };
 
+static int
+check_usage (int rates, int devices, int peak, const char *service,
+             int shift, const char *units, char *warning, char *critical,
+             char **status_msg, perfdata *pd)
+{
+  thresholds *my_thresholds[3];
+  float percent_used = 0, percent_checked;
+  int i, status;
+#ifdef HAVE_LINUX_PROCFS
+  sampler_window window;
+  int have_window = FALSE;
+#endif
+
+  if (rates)
+    status = set_thresholds_list (my_thresholds, 3, warning, critical);
+  else
+    status = set_thresholds (&my_thresholds[0], warning, critical);
+  if (status == NP_RANGE_UNPARSEABLE)
+    usage (stderr);
+
+  swapinfo ();
+
+  if (kb_swap_total != 0)
+    percent_used = (kb_swap_used * 100.0 / kb_swap_total);
+  percent_checked = percent_used;
+
+#ifdef HAVE_LINUX_PROCFS
+  if (peak)
+    have_window = sampler_peak ("check_swap_peak", service, &window);
+  if (have_window && kb_swap_total != 0 &&
+      window.max[SAMPLER_SWAP_USED] * 100.0 / kb_swap_total > percent_checked)
+    percent_checked = window.max[SAMPLER_SWAP_USED] * 100.0 / kb_swap_total;
+
+  /* with zram and zswap what matters is the RAM used by the swap */
+  if (devices)
+    {
+      swapdevinfo ();
+      status = get_status (compressed_swap_percent, my_thresholds[0]);
+    }
+  else
+#endif
+  status = get_status (percent_checked, my_thresholds[0]);
+
+#ifdef HAVE_LINUX_PROCFS
+  /* a host swapping in and out heavily is in trouble, even when
+   * little swap space is in use
+   */
+  if (rates)
+    {
+      swaprateinfo ();
+      /* the average since the previous run hides the bursts */
+      if (have_window && window.max[SAMPLER_SWAPIN_RATE] > swap_pagein_rate)
+        status = max_state (status,
+                            get_status (window.max[SAMPLER_SWAPIN_RATE],
+                                        my_thresholds[1]));
+      status = max_state (status,
+                          get_status (swap_pagein_rate, my_thresholds[1]));
+      status = max_state (status,
+                          get_status (swap_pageout_rate, my_thresholds[2]));
+    }
+#endif
+
+  for (i = 0; i < (rates ? 3 : 1); i++)
+    free (my_thresholds[i]);
+
+  *status_msg = get_swap_status (status, percent_used, shift, units);
+  get_swap_perfdata (pd);
+
+#ifdef HAVE_LINUX_PROCFS
+  if (devices)
+    {
+      free (*status_msg);
+      *status_msg = get_swapdev_status (status, shift, units);
+      get_swapdev_perfdata (pd);
+    }
+  if (rates)
+    {
+      *status_msg = append_msg (*status_msg, get_swaprate_status ());
+      get_swaprate_perfdata (pd);
+    }
+  if (peak)
+    {
+      *status_msg = append_msg (*status_msg,
+                                get_sampler_status (&window,
+                                                    SAMPLER_SWAP_USED,
+                                                    kb_swap_total, shift,
+                                                    units));
+      get_sampler_perfdata (pd, &window, SAMPLER_SWAP_USED, "swap_used");
+      get_sampler_perfdata (pd, &window, SAMPLER_SWAPIN_RATE,
+                            "pswpin_rate");
+    }
+#endif
+
+  return status;
+}
+
+static int
+check_expression (int shift, const char *units, char *warning, char *critical,
+                  char **status_msg, perfdata *pd)
+{
+  expression warn_expr, crit_expr;
+  float percent_used = 0;
+  int status;
+
+  metrics_compile (&warn_expr, warning);
+  metrics_compile (&crit_expr, critical);
+
+  metricsinfo (CACHE_IS_USED, &warn_expr, &crit_expr);
+  status = get_metrics_state (&warn_expr, &crit_expr);
+
+  if (kb_swap_total != 0)
+    percent_used = (kb_swap_used * 100.0 / kb_swap_total);
+
+  *status_msg = append_msg (get_swap_status (status, percent_used,
+                                             shift, units),
+                            get_metrics_status (status,
+                                                &warn_expr, &crit_expr));
+  get_swap_perfdata (pd);
+  get_metrics_perfdata (pd, &warn_expr, &crit_expr);
+
+  return status;
+}
+
 int
 main (int argc, char **argv)
 {
   int c, status;
   int shift = 10;
+  int rates = 0;
+  int devices = 0;
+  int peak = 0;
   char *critical = NULL, *warning = NULL;
   char *units = NULL;
+  char *textfile = NULL;
   char *status_msg;
-  char *perfdata_msg;
-  thresholds *my_threshold = NULL;
-  float percent_used = 0;
+  int output_format = PERFDATA_FORMAT_NAGIOS;
+  perfdata pd = { NULL, 0, 0 };
+  passive ps = { NULL, NULL, NULL, 1, 0 };
 
   while ((c = getopt_long (argc, argv, "c:w:bkmghV", longopts, NULL)) != -1)
     {
@@ -116,33 +344,85 @@ main (int argc, char **argv)
         case 'k': shift = 10; units = strdup ("kB"); break;
         case 'm': shift = 20; units = strdup ("MB"); break;
         case 'g': shift = 30; units = strdup ("GB"); break;
+        case OUTPUT_OPTION:
+          if ((output_format = perfdata_format_parse (optarg)) < 0)
+            usage (stderr);
+          break;
+        case TEXTFILE_OPTION:
+          textfile = optarg;
+          break;
+        case SELF_PROFILE_OPTION:
+          profile_enable ();
+          break;
+        case PASSIVE_OPTION:
+          ps.dest = optarg;
+          break;
+        case HOST_OPTION:
+          ps.host = optarg;
+          break;
+        case SERVICE_OPTION:
+          ps.service = optarg;
+          break;
+        case BATCH_OPTION:
+          if (passive_batch_parse (&ps, optarg) < 0)
+            usage (stderr);
+          break;
+        case RATES_OPTION:
+          rates = 1;
+          break;
+        case DEVICES_OPTION:
+          devices = 1;
+          break;
+        case PEAK_OPTION:
+          peak = 1;
+          break;
         }
     }
 
-  status = set_thresholds (&my_threshold, warning, critical);
-  if (status == NP_RANGE_UNPARSEABLE)
-    usage (stderr);
-
   /* output in kilobytes by default */
   if (units == NULL)
     units = strdup ("kB");
 
-  swapinfo ();
-
-  if (kb_swap_total != 0)
-    percent_used = (kb_swap_used * 100.0 / kb_swap_total);
-
-  status = get_status (percent_used, my_threshold);
-  free (my_threshold);
+  if (ps.dest == NULL &&
+      (ps.host || (ps.service && !peak) || ps.batch_count != 1 ||
+       ps.batch_age))
+    usage (stderr);
+  if (ps.service == NULL)
+    ps.service = program_name;
+  /* the thresholds of --devices apply to the compressed swap, not to the
+   * swap used checked by --peak
+   */
+  if (peak && devices)
+    usage (stderr);
 
-  status_msg = get_swap_status (status, percent_used, shift, units);
-  perfdata_msg = get_swap_perfdata (shift, units);
+  /* a range and an expression cannot be mixed */
+  if (expr_is_expression (warning) || expr_is_expression (critical))
+    {
+      if ((warning && !expr_is_expression (warning)) ||
+          (critical && !expr_is_expression (critical)))
+        usage (stderr);
+      if (rates || devices || peak)
+        usage (stderr);
+      status = check_expression (shift, units, warning, critical,
+                                 &status_msg, &pd);
+    }
+  else
+    status = check_usage (rates, devices, peak, ps.service, shift, units,
+                          warning, critical, &status_msg, &pd);
 
-  printf ("%s | %s\n", status_msg, perfdata_msg);
+  if (profile_enabled)
+    get_profile_perfdata (&pd, output_format, program_name, status,
+                          status_msg, shift, units);
+  if (textfile)
+    perfdata_textfile (textfile, program_name, status, &pd);
+  if (ps.dest)
+    passive_submit (&ps, status, status_msg, &pd, shift, units);
+  perfdata_print (stdout, output_format, program_name, status, status_msg,
+                  &pd, shift, units);
 
   free (units);
   free (status_msg);
-  free (perfdata_msg);
+  perfdata_free (&pd);
 
   return status;
 }
@@ -0,0 +1,393 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Compiler and evaluator of the threshold expressions
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_STRINGS_H
+#include <strings.h>
+#endif
+
+#include "expr.h"
+
+/* The grammar:
+ *
+ *   or      := and { '||' and }
+ *   and     := not { '&&' not }
+ *   not     := '!' not | compare
+ *   compare := operand [ ('<' | '<=' | '>' | '>=' | '==' | '!=') operand ]
+ *   operand := '(' or ')' | metric | number [unit]
+ *
+ * The units are binary multiples of a byte: B, k, kB, KiB, M, MB, MiB,
+ * G, GB, GiB, T, TB, TiB (case insensitive); '%' is allowed and ignored.
+ */
+
+enum expr_type
+{
+  EXPR_TYPE_ERROR,
+  EXPR_TYPE_VALUE,
+  EXPR_TYPE_BOOL
+};
+
+typedef struct parser_struct
+{
+  const char *pos;
+  expression *expr;
+  expr_lookup_fn lookup;
+  const char *error;
+} parser;
+
+static const struct
+{
+  const char *name;
+  double factor;
+} expr_units[] = {
+  { "b",   1.0 },
+  { "k",   1024.0 },
+  { "kb",  1024.0 },
+  { "kib", 1024.0 },
+  { "m",   1048576.0 },
+  { "mb",  1048576.0 },
+  { "mib", 1048576.0 },
+  { "g",   1073741824.0 },
+  { "gb",  1073741824.0 },
+  { "gib", 1073741824.0 },
+  { "t",   1099511627776.0 },
+  { "tb",  1099511627776.0 },
+  { "tib", 1099511627776.0 }
+};
+
+static int parse_or (parser *);
+
+static void
+skip_spaces (parser *p)
+{
+  while (isspace ((unsigned char) *p->pos))
+    p->pos++;
+}
+
+static int
+accept (parser *p, const char *token)
+{
+  size_t len = strlen (token);
+
+  skip_spaces (p);
+  if (strncmp (p->pos, token, len) != 0)
+    return 0;
+  p->pos += len;
+  return 1;
+}
+
+static int
+fail (parser *p, const char *error)
+{
+  if (p->error == NULL)
+    p->error = error;
+  return EXPR_TYPE_ERROR;
+}
+
+static int
+emit (parser *p, int opcode, int metric, double value)
+{
+  expression *expr = p->expr;
+
+  if (expr->len == EXPR_MAX_CODE)
+    return fail (p, "expression too long");
+
+  expr->code[expr->len].opcode = opcode;
+  expr->code[expr->len].metric = metric;
+  expr->code[expr->len].value = value;
+  expr->len++;
+
+  return EXPR_TYPE_VALUE;
+}
+
+static int
+parse_number (parser *p)
+{
+  const char *unit;
+  char *end;
+  double value;
+  size_t i, len;
+
+  value = strtod (p->pos, &end);
+  if (end == p->pos)
+    return fail (p, "number expected");
+
+  for (unit = end, len = 0; isalpha ((unsigned char) unit[len]); len++)
+    ;
+  if (len > 0)
+    {
+      for (i = 0; i < sizeof (expr_units) / sizeof (expr_units[0]); i++)
+	if (strlen (expr_units[i].name) == len &&
+	    strncasecmp (expr_units[i].name, unit, len) == 0)
+	  break;
+      if (i == sizeof (expr_units) / sizeof (expr_units[0]))
+	{
+	  p->pos = unit;
+	  return fail (p, "unknown unit");
+	}
+      value *= expr_units[i].factor;
+    }
+  else if (*end == '%')
+    len = 1;
+  p->pos = end + len;
+
+  return emit (p, EXPR_CONST, -1, value);
+}
+
+static int
+parse_operand (parser *p)
+{
+  const char *name;
+  int metric, type;
+
+  skip_spaces (p);
+  if (accept (p, "("))
+    {
+      type = parse_or (p);
+      if (type != EXPR_TYPE_ERROR && !accept (p, ")"))
+	return fail (p, "')' expected");
+      return type;
+    }
+
+  if (!isalpha ((unsigned char) *p->pos) && *p->pos != '_')
+    return parse_number (p);
+
+  for (name = p->pos; isalnum ((unsigned char) *p->pos) || *p->pos == '_';
+       p->pos++)
+    ;
+  if ((metric = p->lookup (name, p->pos - name)) < 0)
+    {
+      p->pos = name;
+      return fail (p, "unknown metric");
+    }
+
+  return emit (p, EXPR_METRIC, metric, 0);
+}
+
+static int
+parse_compare (parser *p)
+{
+  static const struct
+  {
+    const char *token;
+    int opcode;
+  } operators[] = {
+    /* the two characters operators first */
+    { "<=", EXPR_LE }, { ">=", EXPR_GE }, { "==", EXPR_EQ }, { "!=", EXPR_NE },
+    { "<", EXPR_LT }, { ">", EXPR_GT }
+  };
+  const char *start;
+  size_t i;
+  int type;
+
+  if ((type = parse_operand (p)) != EXPR_TYPE_VALUE)
+    return type;
+
+  for (i = 0; i < sizeof (operators) / sizeof (operators[0]); i++)
+    if (accept (p, operators[i].token))
+      break;
+  if (i == sizeof (operators) / sizeof (operators[0]))
+    return EXPR_TYPE_VALUE;
+
+  start = p->pos;
+  if ((type = parse_operand (p)) == EXPR_TYPE_ERROR)
+    return type;
+  if (type != EXPR_TYPE_VALUE)
+    {
+      p->pos = start;
+      return fail (p, "a metric or a number expected");
+    }
+  if (emit (p, operators[i].opcode, -1, 0) == EXPR_TYPE_ERROR)
+    return EXPR_TYPE_ERROR;
+
+  return EXPR_TYPE_BOOL;
+}
+
+static int
+parse_not (parser *p)
+{
+  const char *start;
+  int type;
+
+  skip_spaces (p);
+  /* do not take the operator '!=' for a negation */
+  if (p->pos[0] != '!' || p->pos[1] == '=')
+    return parse_compare (p);
+
+  p->pos++;
+  start = p->pos;
+  if ((type = parse_not (p)) == EXPR_TYPE_ERROR)
+    return type;
+  if (type != EXPR_TYPE_BOOL)
+    {
+      p->pos = start;
+      return fail (p, "a condition expected after '!'");
+    }
+  emit (p, EXPR_NOT, -1, 0);
+
+  return (p->error ? EXPR_TYPE_ERROR : EXPR_TYPE_BOOL);
+}
+
+/* Parse a list of conditions joined by the logical operator 'token' */
+static int
+parse_logical (parser *p, const char *token, int opcode, int (*parse) (parser *))
+{
+  const char *start;
+  int type;
+
+  skip_spaces (p);
+  start = p->pos;
+  if ((type = parse (p)) == EXPR_TYPE_ERROR)
+    return type;
+
+  while (accept (p, token))
+    {
+      if (type != EXPR_TYPE_BOOL)
+	{
+	  p->pos = start;
+	  return fail (p, "a condition expected");
+	}
+      skip_spaces (p);
+      start = p->pos;
+      if ((type = parse (p)) == EXPR_TYPE_ERROR)
+	return type;
+      if (type != EXPR_TYPE_BOOL)
+	{
+	  p->pos = start;
+	  return fail (p, "a condition expected");
+	}
+      if (emit (p, opcode, -1, 0) == EXPR_TYPE_ERROR)
+	return EXPR_TYPE_ERROR;
+    }
+
+  return type;
+}
+
+static int
+parse_and (parser *p)
+{
+  return parse_logical (p, "&&", EXPR_AND, parse_not);
+}
+
+static int
+parse_or (parser *p)
+{
+  return parse_logical (p, "||", EXPR_OR, parse_and);
+}
+
+/*
+ * Returns TRUE if the threshold 'str' is an expression and not a range
+ * (the ranges start with a number, '@', '~' or ':')
+ */
+int
+expr_is_expression (const char *str)
+{
+  if (str == NULL)
+    return 0;
+  while (isspace ((unsigned char) *str))
+    str++;
+  return (isalpha ((unsigned char) *str) || *str == '_' ||
+	  *str == '(' || *str == '!');
+}
+
+/*
+ * Compile the expression 'text', resolving the metric names with 'lookup'.
+ * Returns 0 if okay, otherwise the position of the error (starting from 1)
+ * and sets 'error' to a static message.
+ */
+int
+expr_compile (expression *expr, const char *text, expr_lookup_fn lookup,
+	      const char **error)
+{
+  parser p = { text, expr, lookup, NULL };
+  int type;
+
+  expr->text = text;
+  expr->len = 0;
+
+  type = parse_or (&p);
+  skip_spaces (&p);
+  if (type == EXPR_TYPE_VALUE)
+    fail (&p, "the expression is not a condition");
+  else if (type == EXPR_TYPE_BOOL && *p.pos != '\0')
+    fail (&p, "unexpected characters");
+
+  if (p.error)
+    {
+      expr->len = 0;
+      *error = p.error;
+      return p.pos - text + 1;
+    }
+
+  return 0;
+}
+
+/*
+ * Returns TRUE if the compiled expression is true for the metrics 'values'.
+ * An empty expression is never true.
+ */
+int
+expr_eval (const expression *expr, const double *values)
+{
+  double stack[EXPR_MAX_CODE];
+  const expr_insn *insn;
+  int sp = 0;
+  double a, b;
+
+  if (expr->len == 0)
+    return 0;
+
+  for (insn = expr->code; insn < expr->code + expr->len; insn++)
+    {
+      switch (insn->opcode)
+	{
+	case EXPR_CONST:
+	  stack[sp++] = insn->value;
+	  continue;
+	case EXPR_METRIC:
+	  stack[sp++] = values[insn->metric];
+	  continue;
+	case EXPR_NOT:
+	  stack[sp - 1] = !stack[sp - 1];
+	  continue;
+	}
+
+      /* binary operators */
+      b = stack[--sp];
+      a = stack[sp - 1];
+      switch (insn->opcode)
+	{
+	case EXPR_LT:  stack[sp - 1] = (a < b);   break;
+	case EXPR_LE:  stack[sp - 1] = (a <= b);  break;
+	case EXPR_GT:  stack[sp - 1] = (a > b);   break;
+	case EXPR_GE:  stack[sp - 1] = (a >= b);  break;
+	case EXPR_EQ:  stack[sp - 1] = (a == b);  break;
+	case EXPR_NE:  stack[sp - 1] = (a != b);  break;
+	case EXPR_AND: stack[sp - 1] = (a && b);  break;
+	case EXPR_OR:  stack[sp - 1] = (a || b);  break;
+	}
+    }
+
+  return (stack[0] != 0);
+}
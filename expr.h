@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Threshold expressions, like 'swap_used_pct > 50 && pswpin_rate > 200'.
+ * An expression is compiled once in a flat array of instructions for a
+ * stack machine, that is evaluated without any memory allocation.
+ */
+
+#define EXPR_MAX_CODE 64
+
+enum expr_opcode
+{
+  EXPR_CONST,			/* push 'value' */
+  EXPR_METRIC,			/* push the value of the metric 'metric' */
+  EXPR_LT,
+  EXPR_LE,
+  EXPR_GT,
+  EXPR_GE,
+  EXPR_EQ,
+  EXPR_NE,
+  EXPR_NOT,
+  EXPR_AND,
+  EXPR_OR
+};
+
+typedef struct expr_insn_struct
+{
+  unsigned char opcode;
+  short metric;
+  double value;
+} expr_insn;
+
+typedef struct expression_struct
+{
+  const char *text;		/* NULL if no expression was given */
+  int len;
+  expr_insn code[EXPR_MAX_CODE];
+} expression;
+
+/* Return the index of the metric 'name' (of length 'len'), or -1 */
+typedef int (*expr_lookup_fn) (const char *name, size_t len);
+
+int expr_is_expression (const char *);
+int expr_compile (expression *, const char *, expr_lookup_fn, const char **);
+int expr_eval (const expression *, const double *);
@@ -0,0 +1,154 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A Nagios plugin to check the Kernel Samepage Merging on linux
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "profile.h"
+#include "vminfo.h"
+
+#define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
+
+#define SYS_KSM "/sys/kernel/mm/ksm/"
+
+extern unsigned long kb_main_total;
+
+/* see Documentation/admin-guide/mm/ksm.rst */
+static unsigned long long ksm_run;
+static unsigned long long ksm_pages_shared;	/* shared pages in use */
+static unsigned long long ksm_pages_sharing;	/* sites sharing them */
+static unsigned long long ksm_pages_unshared;	/* unique, but checked */
+static unsigned long long ksm_pages_volatile;	/* changing too fast */
+static unsigned long long ksm_full_scans;
+static long long ksm_general_profit;		/* bytes, 6.1+ */
+
+int ksm_available;
+unsigned long kb_ksm_saved;
+float ksm_saved_percent;
+static double ksm_ratio;
+
+static int
+ksm_read (const char *name, unsigned long long *value)
+{
+  char path[128];
+
+  snprintf (path, sizeof path, SYS_KSM "%s", name);
+  if (!read_file_ull (path, value))
+    {
+      *value = 0;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+void
+ksminfo (void)
+{
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+  unsigned long long profit;
+  double start;
+  FILE *fp;
+
+  if (kb_page <= 0)
+    kb_page = 4;
+
+  ksm_available = ksm_read ("run", &ksm_run);
+  ksm_read ("pages_shared", &ksm_pages_shared);
+  ksm_read ("pages_sharing", &ksm_pages_sharing);
+  ksm_read ("pages_unshared", &ksm_pages_unshared);
+  ksm_read ("pages_volatile", &ksm_pages_volatile);
+  ksm_read ("full_scans", &ksm_full_scans);
+
+  /* each page in pages_sharing is a page of memory saved; the general
+   * profit also takes into account the cost of the rmap items of the
+   * pages being scanned, and can be negative
+   */
+  ksm_general_profit = (long long) (ksm_pages_sharing * kb_page) << 10;
+  start = profile_start ();
+  if ((fp = fopen (SYS_KSM "general_profit", "r")) != NULL)
+    {
+      if (fscanf (fp, "%lld", &ksm_general_profit) != 1)
+	ksm_general_profit = (long long) (ksm_pages_sharing * kb_page) << 10;
+      profile_fclose (fp, SYS_KSM "general_profit", start);
+    }
+  profit = (ksm_general_profit > 0) ? ksm_general_profit : 0;
+
+  /* the savings are net of the metadata, the gross ones are ksm_sharing */
+  kb_ksm_saved = profit >> 10;
+  ksm_saved_percent = 0;
+  if (kb_main_total != 0)
+    ksm_saved_percent = kb_ksm_saved * 100.0 / kb_main_total;
+
+  ksm_ratio = 0;
+  if (ksm_pages_shared != 0)
+    ksm_ratio = (double) ksm_pages_sharing / ksm_pages_shared;
+}
+
+char *
+get_ksm_status (int status, float percent_used, int shift, const char *units)
+{
+  char *msg;
+  int ret;
+
+  if (!ksm_available)
+    ret = asprintf (&msg, "%s: KSM is not supported by the kernel",
+		    state_text (status));
+  else
+    ret = asprintf (&msg, "%s: KSM saves %.2f%% (%Lu%s) of the memory, "
+		    "merge ratio %.2f, %.2f%% of the memory used%s",
+		    state_text (status), ksm_saved_percent,
+		    SU (kb_ksm_saved), ksm_ratio, percent_used,
+		    ksm_run == 1 ? "" : " (KSM not running)");
+
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting KSM status\n");
+
+  return msg;
+}
+
+void
+get_ksm_perfdata (perfdata *pd)
+{
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+
+  if (kb_page <= 0)
+    kb_page = 4;
+
+  perfdata_add (pd, "ksm_saved", PERFDATA_KB, kb_ksm_saved);
+  perfdata_add (pd, "ksm_saved_pct", PERFDATA_PERCENT, ksm_saved_percent);
+  perfdata_add (pd, "ksm_ratio", PERFDATA_NONE, ksm_ratio);
+  perfdata_add (pd, "ksm_shared", PERFDATA_KB, ksm_pages_shared * kb_page);
+  perfdata_add (pd, "ksm_sharing", PERFDATA_KB, ksm_pages_sharing * kb_page);
+  perfdata_add (pd, "ksm_unshared", PERFDATA_KB,
+		ksm_pages_unshared * kb_page);
+  perfdata_add (pd, "ksm_volatile", PERFDATA_KB,
+		ksm_pages_volatile * kb_page);
+  perfdata_add (pd, "ksm_full_scans", PERFDATA_COUNT | PERFDATA_COUNTER,
+		ksm_full_scans);
+  perfdata_add (pd, "ksm_general_profit", PERFDATA_BYTES, ksm_general_profit);
+}
@@ -0,0 +1,501 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A Nagios plugin to detect the processes leaking memory on linux
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "profile.h"
+#include "state.h"
+#include "vminfo.h"
+
+#define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
+
+#define PROC_BOOT_ID "/proc/sys/kernel/random/boot_id"
+
+#define LEAK_SAMPLES         24	/* samples kept for each process */
+#define LEAK_SAMPLE_INTERVAL 300	/* seconds between two samples */
+#define LEAK_MIN_SAMPLES     6	/* samples needed for a fit */
+#define LEAK_MIN_R2          0.8	/* the growth must be steady */
+#define LEAK_MIN_KB          1024	/* smaller processes are not tracked */
+#define LEAK_PROCESSES       1024	/* processes tracked, the biggest */
+#define LEAK_TOP             5	/* processes reported */
+
+/* The state file keeps the last samples of each process, identified by
+ * its pid and start time (in clock ticks since boot), so that a reused
+ * pid starts a new history; the history is dropped after a reboot:
+ *
+ * boot_id 8c3b3e3e-5d4e-4bd1-a6a9-0e5c4f1c2c9a
+ * metric rss
+ * 1234 56789 nginx 1412243100:20480 1412243400:20544 ...
+ */
+
+typedef struct leak_process_struct
+{
+  int pid;
+  unsigned long long starttime;
+  char comm[32];
+  int seen;
+  int count;			/* samples, the oldest first */
+  long time[LEAK_SAMPLES];
+  unsigned long kb[LEAK_SAMPLES];
+  double growth;		/* kB per hour, by least squares */
+  int sustained;		/* the growth is steady */
+} leak_process;
+
+static leak_process *leak_procs;
+static int leak_procs_count;
+static int leak_procs_alloc;
+static int leak_pss;
+
+int leak_processes;		/* processes tracked */
+int leak_growing;		/* with a sustained growth */
+double leak_max_growth;		/* kB per hour */
+
+static leak_process *
+leak_process_add (int pid, unsigned long long starttime, const char *comm)
+{
+  leak_process *proc;
+  char *s;
+
+  if (leak_procs_count == leak_procs_alloc)
+    {
+      leak_procs_alloc = leak_procs_alloc ? leak_procs_alloc * 2 : 256;
+      leak_procs = realloc (leak_procs,
+			    leak_procs_alloc * sizeof (leak_process));
+      if (leak_procs == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+
+  proc = &leak_procs[leak_procs_count++];
+  memset (proc, 0, sizeof (leak_process));
+  proc->pid = pid;
+  proc->starttime = starttime;
+
+  /* the command names can have spaces */
+  snprintf (proc->comm, sizeof proc->comm, "%s", comm);
+  for (s = proc->comm; *s; s++)
+    if (isspace ((unsigned char) *s))
+      *s = '_';
+
+  return proc;
+}
+
+static void
+leak_sample (leak_process *proc, long now, unsigned long kb)
+{
+  if (proc->count == LEAK_SAMPLES)
+    {
+      memmove (proc->time, proc->time + 1,
+	       (LEAK_SAMPLES - 1) * sizeof (proc->time[0]));
+      memmove (proc->kb, proc->kb + 1,
+	       (LEAK_SAMPLES - 1) * sizeof (proc->kb[0]));
+      proc->count--;
+    }
+
+  proc->time[proc->count] = now;
+  proc->kb[proc->count++] = kb;
+}
+
+static char *
+leak_state_path (void)
+{
+  char *path;
+
+  if (asprintf (&path, "%s/check_memory_leaks.%u", STATE_DIR,
+		(unsigned int) getuid ()) < 0)
+    die (STATE_UNKNOWN, "Error getting the state file name\n");
+
+  return path;
+}
+
+static void
+leak_state_load (const char *path, const char *boot_id)
+{
+  leak_process *proc;
+  char line[64 + LEAK_SAMPLES * 32], comm[32], id[64], metric[8], *s;
+  unsigned long long starttime;
+  unsigned long kb;
+  long t;
+  int pid, n;
+  FILE *fp;
+
+  if ((fp = state_file_fopen (path)) == NULL)
+    return;
+
+  /* the history of a previous boot, or of another metric, is useless */
+  if (fscanf (fp, "boot_id %63s\nmetric %7s\n", id, metric) != 2 ||
+      strcmp (id, boot_id) ||
+      strcmp (metric, leak_pss ? "pss" : "rss"))
+    {
+      fclose (fp);
+      return;
+    }
+
+  while (fgets (line, sizeof line, fp))
+    {
+      if (sscanf (line, "%d %llu %31s%n", &pid, &starttime, comm, &n) != 3)
+	continue;
+
+      proc = leak_process_add (pid, starttime, comm);
+      for (s = line + n; sscanf (s, " %ld:%lu%n", &t, &kb, &n) == 2; s += n)
+	leak_sample (proc, t, kb);
+    }
+
+  fclose (fp);
+}
+
+/*
+ * Atomically replace the state file with the current samples
+ */
+static void
+leak_state_save (const char *path, const char *boot_id)
+{
+  leak_process *proc;
+  FILE *fp;
+  char *tmp;
+  int i;
+
+  fp = state_file_create (path, 0600, &tmp);
+
+  fprintf (fp, "boot_id %s\nmetric %s\n", boot_id, leak_pss ? "pss" : "rss");
+  for (proc = leak_procs; proc < leak_procs + leak_procs_count; proc++)
+    {
+      fprintf (fp, "%d %llu %s", proc->pid, proc->starttime, proc->comm);
+      for (i = 0; i < proc->count; i++)
+	fprintf (fp, " %ld:%lu", proc->time[i], proc->kb[i]);
+      fputc ('\n', fp);
+    }
+
+  state_file_commit (fp, tmp, path);
+}
+
+/* Read a small /proc file, accounted as a single profiling source */
+static ssize_t
+leak_read (const char *path, char *buf, size_t size)
+{
+  double start = profile_start ();
+  ssize_t len;
+  int fd;
+
+  if ((fd = open (path, O_RDONLY)) < 0)
+    return -1;
+  len = read (fd, buf, size - 1);
+  close (fd);
+
+  if (len < 0)
+    return -1;
+  buf[len] = '\0';
+  profile_read ("/proc/pid", start, len);
+
+  return len;
+}
+
+/*
+ * The command name, start time and RSS of the process 'pid', from
+ * /proc/<pid>/stat; the command name, in parentheses, can have spaces
+ * and parentheses
+ */
+static int
+leak_proc_stat (int pid, char *comm, size_t size,
+		unsigned long long *starttime, unsigned long *kb, long kb_page)
+{
+  char path[64], buf[1024], *open_paren, *close_paren;
+  long rss;
+
+  snprintf (path, sizeof path, "/proc/%d/stat", pid);
+  if (leak_read (path, buf, sizeof buf) < 0 ||
+      (open_paren = strchr (buf, '(')) == NULL ||
+      (close_paren = strrchr (buf, ')')) == NULL || close_paren < open_paren)
+    return FALSE;
+
+  *close_paren = '\0';
+  snprintf (comm, size, "%s", open_paren + 1);
+
+  if (sscanf (close_paren + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+	      "%*u %*u %*u %*d %*d %*d %*d %*d %*d %llu %*u %ld",
+	      starttime, &rss) != 2)
+    return FALSE;
+
+  *kb = (rss > 0) ? rss * kb_page : 0;
+  return TRUE;
+}
+
+/* The PSS of the process 'pid' (kernel 4.14+, usually readable by root) */
+static int
+leak_proc_pss (int pid, unsigned long *kb)
+{
+  char path[64], buf[2048], *pss;
+
+  snprintf (path, sizeof path, "/proc/%d/smaps_rollup", pid);
+  if (leak_read (path, buf, sizeof buf) < 0 ||
+      (pss = strstr (buf, "\nPss:")) == NULL)
+    return FALSE;
+
+  return (sscanf (pss, "\nPss: %lu kB", kb) == 1);
+}
+
+/*
+ * Fit the samples with a line by least squares: the slope is the growth
+ * in kB per hour, and the coefficient of determination (r^2) tells if
+ * the growth is steady or the samples just noisy
+ */
+static void
+leak_fit (leak_process *proc)
+{
+  double n = proc->count, x, y, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+  double cov, var_x, var_y;
+  int i;
+
+  proc->growth = 0;
+  proc->sustained = FALSE;
+  if (proc->count < LEAK_MIN_SAMPLES)
+    return;
+
+  for (i = 0; i < proc->count; i++)
+    {
+      x = (proc->time[i] - proc->time[0]) / 3600.0;
+      y = proc->kb[i];
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+      syy += y * y;
+    }
+
+  cov = n * sxy - sx * sy;
+  var_x = n * sxx - sx * sx;
+  var_y = n * syy - sy * sy;
+  if (var_x <= 0 || var_y <= 0)
+    return;
+
+  proc->growth = cov / var_x;
+  proc->sustained = (proc->growth > 0 &&
+		     cov * cov / (var_x * var_y) >= LEAK_MIN_R2);
+}
+
+/* A process with (almost) the same size in all the samples is stable:
+ * only its last sample is kept
+ */
+static int
+leak_stable (const leak_process *proc)
+{
+  unsigned long min = proc->kb[0], max = proc->kb[0];
+  int i;
+
+  if (proc->count < LEAK_MIN_SAMPLES)
+    return FALSE;
+
+  for (i = 1; i < proc->count; i++)
+    {
+      if (proc->kb[i] < min)
+	min = proc->kb[i];
+      if (proc->kb[i] > max)
+	max = proc->kb[i];
+    }
+
+  return (max - min <= 64 || max - min <= max / 100);
+}
+
+static int
+compare_leak_pid (const void *a, const void *b)
+{
+  const leak_process *pa = a, *pb = b;
+
+  if (pa->pid != pb->pid)
+    return (pa->pid > pb->pid) - (pa->pid < pb->pid);
+  return (pa->starttime > pb->starttime) - (pa->starttime < pb->starttime);
+}
+
+static int
+compare_leak_size (const void *a, const void *b)
+{
+  const leak_process *pa = a, *pb = b;
+  unsigned long kb_a = pa->kb[pa->count - 1];
+  unsigned long kb_b = pb->kb[pb->count - 1];
+
+  return (kb_a < kb_b) - (kb_a > kb_b);
+}
+
+/* the processes with a sustained growth first, the fastest first */
+static int
+compare_leak_growth (const void *a, const void *b)
+{
+  const leak_process *pa = a, *pb = b;
+
+  if (pa->sustained != pb->sustained)
+    return pb->sustained - pa->sustained;
+  return (pa->growth < pb->growth) - (pa->growth > pb->growth);
+}
+
+void
+leakinfo (int pss)
+{
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+  long now = time (NULL);
+  unsigned long long starttime;
+  unsigned long kb;
+  leak_process key, *proc;
+  struct dirent *entry;
+  char boot_id[64], comm[32], *path, *end;
+  int i, count, loaded, pid;
+  DIR *dir;
+
+  if (kb_page <= 0)
+    kb_page = 4;
+  leak_pss = pss;
+
+  if (leak_read (PROC_BOOT_ID, boot_id, sizeof boot_id) < 0)
+    die (STATE_UNKNOWN, "Cannot read %s: %s\n", PROC_BOOT_ID,
+	 strerror (errno));
+  boot_id[strcspn (boot_id, "\n")] = '\0';
+
+  path = leak_state_path ();
+  leak_state_load (path, boot_id);
+  qsort (leak_procs, leak_procs_count, sizeof (leak_process),
+	 compare_leak_pid);
+  loaded = leak_procs_count;
+
+  if ((dir = opendir ("/proc")) == NULL)
+    die (STATE_UNKNOWN, "Cannot open /proc: %s\n", strerror (errno));
+
+  while ((entry = readdir (dir)) != NULL)
+    {
+      pid = strtol (entry->d_name, &end, 10);
+      if (*end != '\0' || pid <= 0)
+	continue;
+
+      /* the process may have exited in the meantime */
+      if (!leak_proc_stat (pid, comm, sizeof comm, &starttime, &kb, kb_page))
+	continue;
+      if (pss && !leak_proc_pss (pid, &kb))
+	continue;
+
+      key.pid = pid;
+      key.starttime = starttime;
+      proc = bsearch (&key, leak_procs, loaded, sizeof (leak_process),
+		      compare_leak_pid);
+      if (proc == NULL)
+	{
+	  if (kb < LEAK_MIN_KB)
+	    continue;
+	  proc = leak_process_add (pid, starttime, comm);
+	}
+
+      /* the checks are not run at exact intervals */
+      proc->seen = TRUE;
+      if (proc->count == 0 || now - proc->time[proc->count - 1] >=
+	  LEAK_SAMPLE_INTERVAL - LEAK_SAMPLE_INTERVAL / 10)
+	leak_sample (proc, now, kb);
+    }
+
+  closedir (dir);
+
+  /* prune the processes no longer running, and the history of the
+   * stable ones
+   */
+  for (i = count = 0; i < leak_procs_count; i++)
+    {
+      proc = &leak_procs[i];
+      if (!proc->seen)
+	continue;
+
+      leak_fit (proc);
+      if (!proc->sustained && leak_stable (proc))
+	{
+	  proc->time[0] = proc->time[proc->count - 1];
+	  proc->kb[0] = proc->kb[proc->count - 1];
+	  proc->count = 1;
+	  proc->growth = 0;
+	}
+      leak_procs[count++] = *proc;
+    }
+  leak_procs_count = count;
+
+  if (leak_procs_count > LEAK_PROCESSES)
+    {
+      qsort (leak_procs, leak_procs_count, sizeof (leak_process),
+	     compare_leak_size);
+      leak_procs_count = LEAK_PROCESSES;
+    }
+
+  leak_state_save (path, boot_id);
+  free (path);
+
+  qsort (leak_procs, leak_procs_count, sizeof (leak_process),
+	 compare_leak_growth);
+
+  leak_processes = leak_procs_count;
+  leak_growing = 0;
+  leak_max_growth = 0;
+  for (proc = leak_procs; proc < leak_procs + leak_procs_count; proc++)
+    if (proc->sustained)
+      {
+	if (leak_growing++ == 0)
+	  leak_max_growth = proc->growth;
+      }
+}
+
+char *
+get_leak_status (int status, int shift, const char *units)
+{
+  leak_process *proc;
+  char *msg, *item;
+  int i;
+
+  if (asprintf (&msg, "%s: %d processes tracked (%s), %d growing",
+		state_text (status), leak_processes,
+		leak_pss ? "PSS" : "RSS", leak_growing) < 0)
+    die (STATE_UNKNOWN, "Error getting leaks status\n");
+
+  for (i = 0; i < leak_growing && i < LEAK_TOP; i++)
+    {
+      proc = &leak_procs[i];
+      if (asprintf (&item, "%s[%d] %Lu%s +%.0f%s/h", proc->comm, proc->pid,
+		    SU (proc->kb[proc->count - 1]),
+		    proc->growth * 1024 / (1ULL << shift), units) < 0)
+	die (STATE_UNKNOWN, "Error getting leaks status\n");
+      msg = append_msg (msg, item);
+    }
+
+  return msg;
+}
+
+void
+get_leak_perfdata (perfdata *pd)
+{
+  perfdata_add (pd, "leak_processes", PERFDATA_COUNT, leak_processes);
+  perfdata_add (pd, "leak_growing", PERFDATA_COUNT, leak_growing);
+  perfdata_add (pd, "leak_max_growth", PERFDATA_NONE, leak_max_growth);
+}
@@ -34,45 +34,52 @@
 #include <unistd.h>
 
 #include "nputils.h"
+#include "meminfo.h"
+#include "procfs.h"
+#include "profile.h"
 
 #define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
 
-#ifdef SUPPORT_ATTRIBUTE_ALIAS
-void swapinfo () __attribute__ ((weak, alias ("meminfo")));
-#else
-# pragma weak swapinfo = meminfo
+#ifndef MIN
+# define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #endif
 
 /*#define PROC_MEMINFO  "/proc/meminfo"*/
 static int meminfo_fd = -1;
-#define PROC_STAT     "/proc/stat"
 static int stat_fd = -1;
-#define PROC_VMINFO   "/proc/vmstat"
 static int vminfo_fd = -1;
 
 /* As of 2.6.24 /proc/meminfo seems to need 888 on 64-bit,
  * and would need 1258 if the obsolete fields were there.
+ * /proc/vmstat is much bigger: about 4k on a 6.x kernel.
  */
-static char buf[2048];
+static char buf[8192];
 
-/* This macro opens filename only if necessary and seeks to 0 so
- * that successive calls to the functions are more efficient.
+/* This macro opens filename only if necessary and reads it from the
+ * offset 0 with pread, so that successive calls to the functions are
+ * more efficient (see sampler-linux.c).
  * It also reads the current contents of the file into the global buf.
  */
 #define FILE_TO_BUF(filename, fd) do{                           \
-    static int local_n;                                         \
+    static int local_n, local_len;                              \
+    double local_start = profile_start ();                      \
     if (fd == -1 && (fd = open(filename, O_RDONLY)) == -1) {    \
         fputs("Error: /proc must be mounted\n", stdout);        \
         fflush(NULL);                                           \
         exit(STATE_UNKNOWN);                                    \
     }                                                           \
-    lseek(fd, 0L, SEEK_SET);                                    \
-    if ((local_n = read(fd, buf, sizeof buf - 1)) < 0) {        \
+    local_len = 0;                                              \
+    while ((local_n = pread(fd, buf + local_len,                \
+                            sizeof buf - 1 - local_len,         \
+                            local_len)) > 0)                    \
+        local_len += local_n;                                   \
+    if (local_n < 0) {                                          \
         perror(filename);                                       \
         fflush(NULL);                                           \
         exit(STATE_UNKNOWN);                                    \
     }                                                           \
-    buf[local_n] = '\0';                                        \
+    buf[local_len] = '\0';                                      \
+    profile_read (filename, local_start, local_len);            \
 }while(0)
 
 /* example data, following junk, with comments added:
@@ -116,6 +123,8 @@ unsigned long kb_main_free;
 unsigned long kb_main_total;
 unsigned long kb_swap_free;
 unsigned long kb_swap_total;
+/* MemFree as read, kb_main_free is the free memory of the accounting */
+unsigned long kb_main_memfree;
 /* recently introduced */
 unsigned long kb_high_free;
 unsigned long kb_high_total;
@@ -147,10 +156,31 @@ static unsigned long kb_vmalloc_used;
 // seen on 2.6.24-rc6-git12
 static unsigned long kb_anon_pages;
 static unsigned long kb_bounce;
-static unsigned long kb_commit_limit;
+unsigned long kb_commit_limit;
 static unsigned long kb_nfs_unstable;
 static unsigned long kb_swap_reclaimable;
-static unsigned long kb_swap_unreclaimable;
+unsigned long kb_swap_unreclaimable;
+// seen on 2.6.28+ kernels
+unsigned long kb_active_file;
+unsigned long kb_inactive_file;
+// seen on 2.6.32+ kernels
+unsigned long kb_shmem;		/* tmpfs and shared memory, part of Cached */
+// seen on 3.14+ kernels
+unsigned long kb_main_available;
+// used by the memory breakdown
+static unsigned long kb_active_anon;	/* 2.6.28+ */
+static unsigned long kb_inactive_anon;
+static unsigned long kb_unevictable;
+static unsigned long kb_mlocked;
+static unsigned long kb_kernel_stack;	/* 2.6.32+ */
+static unsigned long kb_sec_pagetables;	/* 6.2+ */
+static unsigned long kb_percpu;		/* 3.18+ */
+static unsigned long kb_hugetlb;	/* 5.16+ */
+static unsigned long nr_hugepages_total;
+static unsigned long kb_hugepagesize;
+// seen on 5.19+ kernels
+unsigned long kb_zswap;		/* memory used by the zswap pool */
+unsigned long kb_zswapped;	/* uncompressed size of the pages in zswap */
 
 /* read /proc/vminfo only for 2.5.41 and above */
 
@@ -191,22 +221,24 @@ unsigned long vm_kswapd_steal; /* pages reclaimed by kswapd */
 unsigned long vm_pageoutrun;  /* times kswapd ran page reclaim */
 unsigned long vm_allocstall;  /* times a page allocator ran direct reclaim */
 unsigned long vm_pgrotated;   /* pages rotated to the tail of the LRU for immediate reclaim */
-/* seen on a 2.6.8-rc1 kernel, apparently replacing old fields */
-static unsigned long vm_pgalloc_dma;
-static unsigned long vm_pgalloc_high;
-static unsigned long vm_pgalloc_normal;
-static unsigned long vm_pgrefill_dma;
-static unsigned long vm_pgrefill_high;
-static unsigned long vm_pgrefill_normal;
-static unsigned long vm_pgscan_direct_dma;
-static unsigned long vm_pgscan_direct_high;
-static unsigned long vm_pgscan_direct_normal;
-static unsigned long vm_pgscan_kswapd_dma;
-static unsigned long vm_pgscan_kswapd_high;
-static unsigned long vm_pgscan_kswapd_normal;
-static unsigned long vm_pgsteal_dma;
-static unsigned long vm_pgsteal_high;
-static unsigned long vm_pgsteal_normal;
+/* writeback (2.6.37+): pages dirtied and written, and the current limits */
+unsigned long vm_nr_dirtied;
+unsigned long vm_nr_written;
+unsigned long vm_nr_dirty_threshold;
+unsigned long vm_nr_dirty_background_threshold;
+/* split by reclaim context: per zone in 2.6.x and 3.x, global since 4.8 */
+unsigned long vm_pgscan_direct;  /* pages scanned by direct reclaim */
+unsigned long vm_pgscan_kswapd;  /* pages scanned by kswapd */
+unsigned long vm_pgsteal_direct; /* pages reclaimed by direct reclaim */
+unsigned long vm_pgsteal_kswapd; /* pages reclaimed by kswapd */
+/* page cache refaults (see mm/workingset.c): 3.15+, split anon,file in 5.9 */
+unsigned long vm_workingset_refault;  /* evicted pages faulted back in */
+unsigned long vm_workingset_activate; /* refaulted pages that were part of the workingset */
+/* processes killed by the OOM killer (4.13+) */
+unsigned long vm_oom_kill;
+// seen on 5.x and 6.x kernels (khugepaged and proactive reclaim)
+static unsigned long vm_pgscan_other;
+static unsigned long vm_pgsteal_other;
 // seen on a 2.6.8-rc1 kernel
 static unsigned long vm_kswapd_inodesteal;
 static unsigned long vm_nr_unstable;
@@ -224,17 +256,29 @@ unsigned long kb_mem_pageouts;
 void
 vminfo (void)
 {
-  char namebuf[16];             /* big enough to hold any row name */
-  vm_table_struct findme = { namebuf, NULL };
+  vm_table_struct findme = { NULL, NULL };
   vm_table_struct *found;
   char *head;
   char *tail;
+  int i;
 
+  /* The per-zone counters (2.6.8+ and 3.x kernels) and the global ones
+   * that replaced them (4.8+) share the same slot, so the values are
+   * summed up.  The table must be kept sorted by name (see strcmp).
+   */
   static const vm_table_struct vm_table[] = {
-    { "allocstall",           &vm_allocstall },
+    { "allocstall",           &vm_allocstall },          /* GONE in 4.10 (now separate dma,dma32,normal,movable) */
+    { "allocstall_device",    &vm_allocstall },
+    { "allocstall_dma",       &vm_allocstall },
+    { "allocstall_dma32",     &vm_allocstall },
+    { "allocstall_movable",   &vm_allocstall },
+    { "allocstall_normal",    &vm_allocstall },
     { "kswapd_inodesteal",    &vm_kswapd_inodesteal },
-    { "kswapd_steal",         &vm_kswapd_steal },
+    { "kswapd_steal",         &vm_kswapd_steal },        /* GONE in 3.4 */
+    { "nr_dirtied",           &vm_nr_dirtied },
     { "nr_dirty",             &vm_nr_dirty },            /* page version of meminfo Dirty */
+    { "nr_dirty_background_threshold", &vm_nr_dirty_background_threshold },
+    { "nr_dirty_threshold",   &vm_nr_dirty_threshold },
     { "nr_mapped",            &vm_nr_mapped },           /* page version of meminfo Mapped */
     { "nr_page_table_pages" , &vm_nr_page_table_pages }, /* same as meminfo PageTables */
     { "nr_pagecache",         &vm_nr_pagecache },        /* gone in 2.5.66+ kernels */
@@ -242,12 +286,17 @@ vminfo (void)
     { "nr_slab",              &vm_nr_slab },             /* page version of meminfo Slab */
     { "nr_unstable",          &vm_nr_unstable },
     { "nr_writeback",         &vm_nr_writeback },        /* page version of meminfo Writeback */
+    { "nr_written",           &vm_nr_written },
+    { "oom_kill",             &vm_oom_kill },
     { "pageoutrun",           &vm_pageoutrun },
     { "pgactivate",           &vm_pgactivate },
     { "pgalloc",              &vm_pgalloc },             /* GONE (now separate dma,high,normal) */
-    { "pgalloc_dma",          &vm_pgalloc_dma },
-    { "pgalloc_high",         &vm_pgalloc_high },
-    { "pgalloc_normal",       &vm_pgalloc_normal },
+    { "pgalloc_device",       &vm_pgalloc },
+    { "pgalloc_dma",          &vm_pgalloc },
+    { "pgalloc_dma32",        &vm_pgalloc },
+    { "pgalloc_high",         &vm_pgalloc },
+    { "pgalloc_movable",      &vm_pgalloc },
+    { "pgalloc_normal",       &vm_pgalloc },
     { "pgdeactivate",         &vm_pgdeactivate },
     { "pgfault",              &vm_pgfault },
     { "pgfree",               &vm_pgfree },
@@ -255,25 +304,57 @@ vminfo (void)
     { "pgmajfault",           &vm_pgmajfault },
     { "pgpgin",               &vm_pgpgin },              /* important */
     { "pgpgout",              &vm_pgpgout },             /* important */
-    { "pgrefill",             &vm_pgrefill },            /* GONE (now separate dma,high,normal) */
-    { "pgrefill_dma",         &vm_pgrefill_dma },
-    { "pgrefill_high",        &vm_pgrefill_high },
-    { "pgrefill_normal",      &vm_pgrefill_normal },
+    { "pgrefill",             &vm_pgrefill },            /* back again in 4.8 */
+    { "pgrefill_dma",         &vm_pgrefill },
+    { "pgrefill_dma32",       &vm_pgrefill },
+    { "pgrefill_high",        &vm_pgrefill },
+    { "pgrefill_movable",     &vm_pgrefill },
+    { "pgrefill_normal",      &vm_pgrefill },
     { "pgrotated",            &vm_pgrotated },
     { "pgscan",               &vm_pgscan },              /* GONE (now separate direct,kswapd and dma,high,normal) */
-    { "pgscan_direct_dma",    &vm_pgscan_direct_dma },
-    { "pgscan_direct_high",   &vm_pgscan_direct_high },
-    { "pgscan_direct_normal", &vm_pgscan_direct_normal },
-    { "pgscan_kswapd_dma",    &vm_pgscan_kswapd_dma },
-    { "pgscan_kswapd_high",   &vm_pgscan_kswapd_high },
-    { "pgscan_kswapd_normal", &vm_pgscan_kswapd_normal },
+    { "pgscan_direct",        &vm_pgscan_direct },       /* important */
+    { "pgscan_direct_dma",    &vm_pgscan_direct },
+    { "pgscan_direct_dma32",  &vm_pgscan_direct },
+    { "pgscan_direct_high",   &vm_pgscan_direct },
+    { "pgscan_direct_movable",&vm_pgscan_direct },
+    { "pgscan_direct_normal", &vm_pgscan_direct },
+    { "pgscan_khugepaged",    &vm_pgscan_other },
+    { "pgscan_kswapd",        &vm_pgscan_kswapd },       /* important */
+    { "pgscan_kswapd_dma",    &vm_pgscan_kswapd },
+    { "pgscan_kswapd_dma32",  &vm_pgscan_kswapd },
+    { "pgscan_kswapd_high",   &vm_pgscan_kswapd },
+    { "pgscan_kswapd_movable",&vm_pgscan_kswapd },
+    { "pgscan_kswapd_normal", &vm_pgscan_kswapd },
+    { "pgscan_proactive",     &vm_pgscan_other },
     { "pgsteal",              &vm_pgsteal },             /* GONE (now separate dma,high,normal) */
-    { "pgsteal_dma",          &vm_pgsteal_dma },
-    { "pgsteal_high",         &vm_pgsteal_high },
-    { "pgsteal_normal",       &vm_pgsteal_normal },
+    { "pgsteal_direct",       &vm_pgsteal_direct },      /* important */
+    { "pgsteal_direct_dma",   &vm_pgsteal_direct },
+    { "pgsteal_direct_dma32", &vm_pgsteal_direct },
+    { "pgsteal_direct_high",  &vm_pgsteal_direct },
+    { "pgsteal_direct_movable",&vm_pgsteal_direct },
+    { "pgsteal_direct_normal",&vm_pgsteal_direct },
+    { "pgsteal_dma",          &vm_pgsteal },             /* GONE in 3.4 (now separate direct,kswapd) */
+    { "pgsteal_dma32",        &vm_pgsteal },
+    { "pgsteal_high",         &vm_pgsteal },
+    { "pgsteal_khugepaged",   &vm_pgsteal_other },
+    { "pgsteal_kswapd",       &vm_pgsteal_kswapd },      /* important */
+    { "pgsteal_kswapd_dma",   &vm_pgsteal_kswapd },
+    { "pgsteal_kswapd_dma32", &vm_pgsteal_kswapd },
+    { "pgsteal_kswapd_high",  &vm_pgsteal_kswapd },
+    { "pgsteal_kswapd_movable",&vm_pgsteal_kswapd },
+    { "pgsteal_kswapd_normal",&vm_pgsteal_kswapd },
+    { "pgsteal_movable",      &vm_pgsteal },
+    { "pgsteal_normal",       &vm_pgsteal },
+    { "pgsteal_proactive",    &vm_pgsteal_other },
     { "pswpin",               &vm_pswpin },              /* important */
     { "pswpout",              &vm_pswpout },             /* important */
     { "slabs_scanned",        &vm_slabs_scanned },
+    { "workingset_activate",  &vm_workingset_activate }, /* GONE in 5.9 (now separate anon,file) */
+    { "workingset_activate_anon", &vm_workingset_activate },
+    { "workingset_activate_file", &vm_workingset_activate },
+    { "workingset_refault",   &vm_workingset_refault },  /* GONE in 5.9 (now separate anon,file) */
+    { "workingset_refault_anon", &vm_workingset_refault },
+    { "workingset_refault_file", &vm_workingset_refault },
   };
   const int vm_table_count = sizeof (vm_table) / sizeof (vm_table_struct);
 
@@ -281,10 +362,8 @@ vminfo (void)
   unsigned long long slotll;
 #endif
 
-  vm_pgalloc = 0;
-  vm_pgrefill = 0;
-  vm_pgscan = 0;
-  vm_pgsteal = 0;
+  for (i = 0; i < vm_table_count; i++)
+    *(vm_table[i].slot) = 0;
 
   FILE_TO_BUF (PROC_VMINFO, vminfo_fd);
 
@@ -294,12 +373,8 @@ vminfo (void)
       tail = strchr (head, ' ');
       if (!tail) break;
       *tail = '\0';
-      if (strlen (head) >= sizeof (namebuf))
-        {
-          head = tail+1;
-          goto nextline;
-        }
-      strcpy (namebuf, head);
+      /* the key is looked up in place, so there is no limit on its length */
+      findme.name = head;
       found = bsearch (&findme, vm_table, vm_table_count,
                        sizeof (vm_table_struct), compare_vm_table_structs);
       head = tail + 1;
@@ -311,9 +386,9 @@ vminfo (void)
        * truncated values.  It's that or change the API for a larger data type.
        */
       slotll = strtoull (head, &tail, 10);
-      *(found->slot) = (unsigned long) slotll;
+      *(found->slot) += (unsigned long) slotll;
 #else
-      *(found->slot) = strtoul (head, &tail, 10);
+      *(found->slot) += strtoul (head, &tail, 10);
 #endif
 
 nextline:
@@ -322,18 +397,74 @@ nextline:
       head = tail + 1;
     }
 
-  if (!vm_pgalloc)
-    vm_pgalloc  = vm_pgalloc_dma + vm_pgalloc_high + vm_pgalloc_normal;
-
-  if (!vm_pgrefill)
-    vm_pgrefill = vm_pgrefill_dma + vm_pgrefill_high + vm_pgrefill_normal;
+  /* 2.6.x kernels only report the pages reclaimed by kswapd */
+  if (!vm_pgsteal_kswapd && !vm_pgsteal_direct && vm_pgsteal)
+    {
+      vm_pgsteal_kswapd = vm_kswapd_steal;
+      vm_pgsteal_direct = vm_pgsteal - vm_kswapd_steal;
+    }
 
   if (!vm_pgscan)
-    vm_pgscan   = vm_pgscan_direct_dma + vm_pgscan_direct_high + vm_pgscan_direct_normal
-                + vm_pgscan_kswapd_dma + vm_pgscan_kswapd_high + vm_pgscan_kswapd_normal;
+    vm_pgscan   = vm_pgscan_direct + vm_pgscan_kswapd + vm_pgscan_other;
 
   if (!vm_pgsteal)
-    vm_pgsteal  = vm_pgsteal_dma + vm_pgsteal_high + vm_pgsteal_normal;
+    vm_pgsteal  = vm_pgsteal_direct + vm_pgsteal_kswapd + vm_pgsteal_other;
+}
+
+/* The sum of the low and high watermarks of the memory zones, in kB */
+static void
+zone_watermarks (unsigned long *wmark_low, unsigned long *wmark_high)
+{
+  unsigned long value;
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+  char line[256];
+  double start = profile_start ();
+  FILE *fp;
+
+  *wmark_low = *wmark_high = 0;
+  if ((fp = fopen (PROC_ZONEINFO, "r")) != NULL)
+    {
+      while (fgets (line, sizeof line, fp))
+	{
+	  if (sscanf (line, " low %lu", &value) == 1)
+	    *wmark_low += value;
+	  else if (sscanf (line, " high %lu", &value) == 1)
+	    *wmark_high += value;
+	}
+      profile_fclose (fp, PROC_ZONEINFO, start);
+    }
+  *wmark_low *= kb_page;
+  *wmark_high *= kb_page;
+}
+
+/* The estimate of the memory available for starting new applications
+ * without swapping, for the kernels that do not provide MemAvailable
+ * (see si_mem_available() in mm/page_alloc.c).
+ * The sum of the low watermarks of the zones is the part of the page
+ * cache and of the reclaimable slab that cannot be freed without
+ * waking up kswapd; the sum of the high watermarks approximates the
+ * memory reserved by the kernel.
+ */
+static unsigned long
+mem_available_estimate (unsigned long wmark_low, unsigned long wmark_high)
+{
+  long available, pagecache, reclaimable;
+
+  available = (long) kb_main_free - (long) wmark_high;
+
+  /* Active(file) and Inactive(file) do not include the shared memory */
+  if (kb_active_file || kb_inactive_file)
+    pagecache = kb_active_file + kb_inactive_file;
+  else
+    pagecache = kb_main_cached + kb_main_buffers - kb_shmem;
+  pagecache -= MIN (pagecache / 2, (long) wmark_low);
+  available += pagecache;
+
+  reclaimable = kb_swap_reclaimable;
+  reclaimable -= MIN (reclaimable / 2, (long) wmark_low);
+  available += reclaimable;
+
+  return (available < 0) ? 0 : available;
 }
 
 typedef struct mem_table_struct {
@@ -348,86 +479,206 @@ compare_mem_table_structs (const void *a, const void *b)
                  ((const mem_table_struct*)b)->name);
 }
 
-void
-meminfo (int cache_is_free)
+static const mem_table_struct mem_table[] = {
+  { "Active",        &kb_active },             /* important */
+  { "Active(anon)",  &kb_active_anon },
+  { "Active(file)",  &kb_active_file },
+  { "AnonPages",     &kb_anon_pages },
+  { "Bounce",        &kb_bounce },
+  { "Buffers",       &kb_main_buffers },       /* important */
+  { "Cached",        &kb_main_cached },        /* important */
+  { "CommitLimit",   &kb_commit_limit },
+  { "Committed_AS",  &kb_committed_as },
+  { "Dirty",         &kb_dirty },              /* kB version of vmstat nr_dirty */
+  { "HighFree",      &kb_high_free },
+  { "HighTotal",     &kb_high_total },
+  { "HugePages_Total", &nr_hugepages_total },
+  { "Hugepagesize",  &kb_hugepagesize },
+  { "Hugetlb",       &kb_hugetlb },
+  { "Inact_clean",   &kb_inact_clean },
+  { "Inact_dirty",   &kb_inact_dirty },
+  { "Inact_laundry", &kb_inact_laundry },
+  { "Inact_target",  &kb_inact_target },
+  { "Inactive",      &kb_inactive },	        /* important */
+  { "Inactive(anon)",&kb_inactive_anon },
+  { "Inactive(file)",&kb_inactive_file },
+  { "KernelStack",   &kb_kernel_stack },
+  { "LowFree",       &kb_low_free },
+  { "LowTotal",      &kb_low_total },
+  { "Mapped",        &kb_mapped },             /* kB version of vmstat nr_mapped */
+  { "MemAvailable",  &kb_main_available },
+  { "MemFree",       &kb_main_free },	        /* important */
+  { "MemShared",     &kb_main_shared },        /* important, but now gone! */
+  { "MemTotal",      &kb_main_total },	        /* important */
+  { "Mlocked",       &kb_mlocked },
+  { "NFS_Unstable",  &kb_nfs_unstable },
+  { "PageTables",    &kb_pagetables },	        /* kB version of vmstat nr_page_table_pages */
+  { "Percpu",        &kb_percpu },
+  { "ReverseMaps",   &nr_reversemaps },        /* same as vmstat nr_page_table_pages */
+  { "SReclaimable",  &kb_swap_reclaimable },   /* "swap reclaimable" (dentry and inode structures) */
+  { "SUnreclaim",    &kb_swap_unreclaimable },
+  { "SecPageTables", &kb_sec_pagetables },
+  { "Shmem",         &kb_shmem },              /* kB version of vmstat nr_shmem */
+  { "Slab",          &kb_slab },               /* kB version of vmstat nr_slab */
+  { "SwapCached",    &kb_swap_cached },
+  { "SwapFree",      &kb_swap_free },          /* important */
+  { "SwapTotal",     &kb_swap_total },         /* important */
+  { "Unevictable",   &kb_unevictable },
+  { "VmallocChunk",  &kb_vmalloc_chunk },
+  { "VmallocTotal",  &kb_vmalloc_total },
+  { "VmallocUsed",   &kb_vmalloc_used },
+  { "Writeback",     &kb_writeback },          /* kB version of vmstat nr_writeback */
+  { "Zswap",         &kb_zswap },
+  { "Zswapped",      &kb_zswapped },
+};
+static const int mem_table_count =
+  sizeof (mem_table) / sizeof (mem_table_struct);
+
+/* The layout of /proc/meminfo found by the previous parse: the key of
+ * each line and its table entry (NULL when not in the table).  The keys
+ * and their order are fixed for a running kernel, so the next parses
+ * only check the keys at the known positions, and fall back to the full
+ * scan when the layout changed (a snapshot of another kernel replayed).
+ */
+#define MEMINFO_LINES 128
+
+typedef struct meminfo_line_struct
+{
+  const mem_table_struct *entry;
+  size_t keylen;
+  char key[16];		/* not set for the keys longer than the table ones */
+} meminfo_line;
+
+static meminfo_line layout[MEMINFO_LINES];
+static int layout_lines;
+
+static unsigned long
+meminfo_value (const char *p, const char *eol)
+{
+  unsigned long value;
+
+  for (; p < eol && (*p == ' ' || *p == '\t'); p++)
+    ;
+  for (value = 0; p < eol && *p >= '0' && *p <= '9'; p++)
+    value = value * 10 + (*p - '0');
+
+  return value;
+}
+
+/* Parse the data with the known layout.  Returns FALSE when it changed. */
+static int
+meminfo_parse_layout (const char *data, size_t len)
+{
+  const char *head, *eol, *end = data + len;
+  const meminfo_line *line = layout;
+
+  for (head = data; head < end; head = eol + 1, line++)
+    {
+      if (line == layout + layout_lines ||
+	  (size_t) (end - head) <= line->keylen ||
+	  head[line->keylen] != ':' ||
+	  (line->keylen < sizeof (line->key) &&
+	   memcmp (head, line->key, line->keylen) != 0))
+	return FALSE;
+
+      head += line->keylen + 1;
+      if ((eol = memchr (head, '\n', end - head)) == NULL)
+	eol = end;
+      if (line->entry)
+	*(line->entry->slot) = meminfo_value (head, eol);
+    }
+
+  return line == layout + layout_lines;
+}
+
+/* Parse the 'len' bytes of /proc/meminfo data, that may not be NUL
+ * terminated and are not modified (the replay parses mapped files).
+ */
+static void
+meminfo_parse (const char *data, size_t len)
 {
   char namebuf[16];		/* big enough to hold any row name */
   mem_table_struct findme = { namebuf, NULL };
   mem_table_struct *found;
-  char *head;
-  char *tail;
-  const char* b;
-  int need_vmstat_file = 0;
-
-  static const mem_table_struct mem_table[] = {
-    { "Active",        &kb_active },             /* important */
-    { "AnonPages",     &kb_anon_pages },
-    { "Bounce",        &kb_bounce },
-    { "Buffers",       &kb_main_buffers },       /* important */
-    { "Cached",        &kb_main_cached },        /* important */
-    { "CommitLimit",   &kb_commit_limit },
-    { "Committed_AS",  &kb_committed_as },
-    { "Dirty",         &kb_dirty },              /* kB version of vmstat nr_dirty */
-    { "HighFree",      &kb_high_free },
-    { "HighTotal",     &kb_high_total },
-    { "Inact_clean",   &kb_inact_clean },
-    { "Inact_dirty",   &kb_inact_dirty },
-    { "Inact_laundry", &kb_inact_laundry },
-    { "Inact_target",  &kb_inact_target },
-    { "Inactive",      &kb_inactive },	        /* important */
-    { "LowFree",       &kb_low_free },
-    { "LowTotal",      &kb_low_total },
-    { "Mapped",        &kb_mapped },             /* kB version of vmstat nr_mapped */
-    { "MemFree",       &kb_main_free },	        /* important */
-    { "MemShared",     &kb_main_shared },        /* important, but now gone! */
-    { "MemTotal",      &kb_main_total },	        /* important */
-    { "NFS_Unstable",  &kb_nfs_unstable },
-    { "PageTables",    &kb_pagetables },	        /* kB version of vmstat nr_page_table_pages */
-    { "ReverseMaps",   &nr_reversemaps },        /* same as vmstat nr_page_table_pages */
-    { "SReclaimable",  &kb_swap_reclaimable },   /* "swap reclaimable" (dentry and inode structures) */
-    { "SUnreclaim",    &kb_swap_unreclaimable },
-    { "Slab",          &kb_slab },               /* kB version of vmstat nr_slab */
-    { "SwapCached",    &kb_swap_cached },
-    { "SwapFree",      &kb_swap_free },          /* important */
-    { "SwapTotal",     &kb_swap_total },         /* important */
-    { "VmallocChunk",  &kb_vmalloc_chunk },
-    { "VmallocTotal",  &kb_vmalloc_total },
-    { "VmallocUsed",   &kb_vmalloc_used },
-    { "Writeback",     &kb_writeback },          /* kB version of vmstat nr_writeback */
-  };
-  const int mem_table_count = sizeof (mem_table) / sizeof (mem_table_struct);
-
-  FILE_TO_BUF (PROC_MEMINFO, meminfo_fd);
+  const char *head, *tail, *eol, *end = data + len;
+  meminfo_line *line;
+  int i, learnt = TRUE;
 
+  for (i = 0; i < mem_table_count; i++)
+    *(mem_table[i].slot) = 0;
   kb_inactive = ~0UL;
 
-  head = buf;
-  for (;;)
+  if (layout_lines && meminfo_parse_layout (data, len))
+    return;
+
+  /* learn the layout while parsing */
+  layout_lines = 0;
+  for (head = data; head < end; head = eol + 1)
     {
-      tail = strchr (head, ':');
+      if ((eol = memchr (head, '\n', end - head)) == NULL)
+	eol = end;
+      line = (layout_lines < MEMINFO_LINES) ? &layout[layout_lines++] : NULL;
+      tail = memchr (head, ':', eol - head);
+      /* too many lines, or a line without a key */
+      if (!line || !tail)
+	learnt = FALSE;
       if (!tail)
-	break;
-      *tail = '\0';
-      if (strlen (head) >= sizeof (namebuf))
+	continue;
+      if (line)
 	{
-	  head = tail + 1;
-	  goto nextline;
+	  line->entry = NULL;
+	  line->keylen = tail - head;
+	  if (line->keylen < sizeof (line->key))
+	    memcpy (line->key, head, line->keylen);
 	}
-      strcpy (namebuf, head);
+
+      if ((size_t) (tail - head) >= sizeof (namebuf))
+	continue;
+      memcpy (namebuf, head, tail - head);
+      namebuf[tail - head] = '\0';
       found = bsearch (&findme, mem_table, mem_table_count,
 		       sizeof (mem_table_struct), compare_mem_table_structs);
-      head = tail + 1;
       if (!found)
-	goto nextline;
-      *(found->slot) = strtoul (head, &tail, 10);
+	continue;
 
-    nextline:
-      tail = strchr (head, '\n');
-      if (!tail)
-	break;
-      head = tail + 1;
+      if (line)
+	line->entry = found;
+      *(found->slot) = meminfo_value (tail + 1, eol);
+    }
+
+  if (!learnt)
+    layout_lines = 0;
+}
+
+/* The memory used with the accounting 'cache_is_free' of the reclaimable
+ * memory (after meminfo_usage)
+ */
+unsigned long
+meminfo_used (int cache_is_free)
+{
+  unsigned long kb_used = kb_main_total - kb_main_memfree, kb_reclaimable;
+
+  switch (cache_is_free)
+    {
+    case CACHE_IS_FREE:
+      /* tmpfs and shared memory are part of Cached, but cannot be
+       * reclaimed: they are not free memory */
+      kb_reclaimable = kb_main_cached + kb_main_buffers;
+      kb_reclaimable -= MIN (kb_shmem, kb_main_cached);
+      kb_used -= MIN (kb_reclaimable, kb_used);
+      break;
+    case AVAILABLE_IS_FREE:
+      kb_used = kb_main_total - kb_main_available;
+      break;
     }
 
+  return kb_used;
+}
+
+/* Compute the memory usage from the parsed fields */
+static void
+meminfo_usage (int cache_is_free)
+{
   if (!kb_low_total)
     {				/* low==main except with large-memory support */
       kb_low_total = kb_main_total;
@@ -439,14 +690,37 @@ meminfo (int cache_is_free)
       kb_inactive = kb_inact_dirty + kb_inact_clean + kb_inact_laundry;
     }
 
-  kb_main_used = kb_main_total - kb_main_free;
-  if (cache_is_free)
+  /* the shared memory is reported as MemShared only by 2.4 kernels */
+  if (!kb_main_shared)
+    kb_main_shared = kb_shmem;
+
+  if (kb_main_available > kb_main_total)
+    kb_main_available = kb_main_total;
+
+  kb_main_memfree = kb_main_free;
+  kb_main_used = meminfo_used (cache_is_free);
+  kb_main_free = kb_main_total - kb_main_used;
+
+  kb_swap_used = kb_swap_total - kb_swap_free;
+}
+
+void
+meminfo (int cache_is_free)
+{
+  const char* b;
+  int need_vmstat_file = 0;
+  unsigned long wmark_low, wmark_high;
+
+  FILE_TO_BUF (PROC_MEMINFO, meminfo_fd);
+  meminfo_parse (buf, strlen (buf));
+
+  if (!kb_main_available)
     {
-      kb_main_used -= (kb_main_cached + kb_main_buffers);
-      kb_main_free += (kb_main_cached + kb_main_buffers);
+      zone_watermarks (&wmark_low, &wmark_high);
+      kb_main_available = mem_available_estimate (wmark_low, wmark_high);
     }
 
-  kb_swap_used = kb_swap_total - kb_swap_free;
+  meminfo_usage (cache_is_free);
 
   /* get additional statistics for memory and swap activity */
 
@@ -476,6 +750,27 @@ meminfo (int cache_is_free)
     }
 }
 
+/*
+ * Compute the memory usage from a /proc/meminfo snapshot of 'len' bytes
+ * (see replay-linux.c).  The zone watermarks of the recorded host are
+ * unknown, so the MemAvailable estimate of the old kernels ignores them.
+ */
+void
+meminfo_snapshot (const char *data, size_t len, int cache_is_free)
+{
+  meminfo_parse (data, len);
+  if (!kb_main_available)
+    kb_main_available = mem_available_estimate (0, 0);
+  meminfo_usage (cache_is_free);
+}
+
+/* the swap statistics are read from /proc/meminfo as well */
+void
+swapinfo (void)
+{
+  meminfo (CACHE_IS_USED);
+}
+
 char *
 get_memory_status (int status, float percent_used, int shift,
                    const char *units)
@@ -508,44 +803,234 @@ get_swap_status (int status, float percent_used, int shift,
   return msg;
 }
 
+void
+get_memory_perfdata (perfdata *pd)
+{
+  static const struct
+  {
+    const char *label;
+    unsigned long *kb;
+    int unit;
+  } memory_perfdata[] = {
+    { "mem_total",    &kb_main_total,   PERFDATA_KB },
+    { "mem_used",     &kb_main_used,    PERFDATA_KB },
+    { "mem_free",     &kb_main_free,    PERFDATA_KB },
+    { "mem_shared",   &kb_main_shared,  PERFDATA_KB },
+    { "mem_buffers",  &kb_main_buffers, PERFDATA_KB },
+    { "mem_cached",   &kb_main_cached,  PERFDATA_KB },
+    /* pgpgin and pgpgout are in kB, since the boot */
+    { "mem_pageins",  &kb_mem_pageins,  PERFDATA_KB | PERFDATA_COUNTER },
+    { "mem_pageouts", &kb_mem_pageouts, PERFDATA_KB | PERFDATA_COUNTER }
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof (memory_perfdata) / sizeof (memory_perfdata[0]); i++)
+    perfdata_add (pd, memory_perfdata[i].label, memory_perfdata[i].unit,
+                  *memory_perfdata[i].kb);
+}
+
+void
+get_swap_perfdata (perfdata *pd)
+{
+  static const struct
+  {
+    const char *label;
+    unsigned long *kb;
+    int unit;
+  } swap_perfdata[] = {
+    { "swap_total",    &kb_swap_total,    PERFDATA_KB },
+    { "swap_used",     &kb_swap_used,     PERFDATA_KB },
+    { "swap_free",     &kb_swap_free,     PERFDATA_KB },
+    /* The amount of swap, in kB, used as cache memory */
+    { "swap_cached",   &kb_swap_cached,   PERFDATA_KB },
+    /* pswpin and pswpout are in pages, since the boot */
+    { "swap_pageins",  &kb_swap_pageins,  PERFDATA_COUNT | PERFDATA_COUNTER },
+    { "swap_pageouts", &kb_swap_pageouts, PERFDATA_COUNT | PERFDATA_COUNTER }
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof (swap_perfdata) / sizeof (swap_perfdata[0]); i++)
+    perfdata_add (pd, swap_perfdata[i].label, swap_perfdata[i].unit,
+                  *swap_perfdata[i].kb);
+}
+
+/* Overcommit policy (see Documentation/vm/overcommit-accounting):
+ * 0 heuristic, 1 always overcommit, 2 strict accounting.  Only with the
+ * strict accounting the allocations fail when Committed_AS reaches
+ * CommitLimit, that is (RAM - hugetlb) * overcommit_ratio / 100 + swap
+ * (or overcommit_kbytes + swap).
+ */
+int overcommit_memory;
+float commit_percent;
+static unsigned long long overcommit_ratio;
+static unsigned long long overcommit_kbytes;
+
+void
+commitinfo (void)
+{
+  unsigned long long value;
+
+  meminfo (CACHE_IS_USED);
+
+  overcommit_memory = 0;
+  if (read_file_ull (PROC_SYS_VM "overcommit_memory", &value))
+    overcommit_memory = value;
+  if (!read_file_ull (PROC_SYS_VM "overcommit_ratio", &overcommit_ratio))
+    overcommit_ratio = 50;
+  if (!read_file_ull (PROC_SYS_VM "overcommit_kbytes", &overcommit_kbytes))
+    overcommit_kbytes = 0;
+
+  /* CommitLimit is missing in 2.6.9 and older kernels */
+  if (!kb_commit_limit)
+    kb_commit_limit = (overcommit_kbytes ? overcommit_kbytes :
+                       kb_main_total * overcommit_ratio / 100) + kb_swap_total;
+
+  commit_percent = 0;
+  if (kb_commit_limit != 0)
+    commit_percent = kb_committed_as * 100.0 / kb_commit_limit;
+}
+
+static const char *
+overcommit_policy (void)
+{
+  switch (overcommit_memory)
+    {
+    case 0:
+      return "heuristic";
+    case 1:
+      return "always";
+    case 2:
+      return "strict";
+    default:
+      return "unknown";
+    }
+}
+
 char *
-get_memory_perfdata (int shift, const char *units)
+get_commit_status (int status, int shift, const char *units)
 {
+  unsigned long kb_headroom = 0;
   char *msg;
   int ret;
 
-  ret = asprintf (&msg,
-                  "mem_total=%Lu%s, mem_used=%Lu%s, mem_free=%Lu%s, "
-                  "mem_shared=%Lu%s, mem_buffers=%Lu%s, mem_cached=%Lu%s, "
-                  "mem_pageins=%Lu%s, mem_pageouts=%Lu%s\n",
-                  SU (kb_main_total), SU (kb_main_used), SU (kb_main_free),
-                  SU (kb_main_shared), SU (kb_main_buffers),
-                  SU (kb_main_cached),
-                  SU (kb_mem_pageins), SU (kb_mem_pageouts));
+  if (kb_commit_limit > kb_committed_as)
+    kb_headroom = kb_commit_limit - kb_committed_as;
+
+  if (overcommit_memory == 2)
+    ret = asprintf (&msg, "%s: %.2f%% of the commit limit used, "
+                    "%Lu%s can still be allocated", state_text (status),
+                    commit_percent, SU (kb_headroom));
+  else
+    ret = asprintf (&msg, "%s: %.2f%% of the commit limit used "
+                    "(not enforced, overcommit policy: %s)",
+                    state_text (status), commit_percent,
+                    overcommit_policy ());
 
   if (ret < 0)
-    die (STATE_UNKNOWN, "Error getting memory perfdata\n");
+    die (STATE_UNKNOWN, "Error getting commit status\n");
 
   return msg;
 }
 
+void
+get_commit_perfdata (perfdata *pd)
+{
+  unsigned long kb_headroom = 0;
+
+  if (kb_commit_limit > kb_committed_as)
+    kb_headroom = kb_commit_limit - kb_committed_as;
+
+  perfdata_add (pd, "mem_committed", PERFDATA_KB, kb_committed_as);
+  perfdata_add (pd, "mem_commit_limit", PERFDATA_KB, kb_commit_limit);
+  perfdata_add (pd, "mem_commit_headroom", PERFDATA_KB, kb_headroom);
+  perfdata_add (pd, "mem_commit_used", PERFDATA_PERCENT, commit_percent);
+}
+
+/* Every kB of MemTotal, split in (almost) disjoint categories.
+ * The shared memory sits in the anon LRU lists; the mlocked pages are
+ * moved to the unevictable one.  VmallocUsed partially overlaps with
+ * the kernel stacks (CONFIG_VMAP_STACK).  The remainder is mostly made
+ * by the pages allocated by the drivers straight from the page
+ * allocator, that the kernel does not account.
+ */
+static unsigned long kb_bd_anon;
+static unsigned long kb_bd_pagetables;
+static unsigned long kb_bd_hugetlb;
+unsigned long kb_unaccounted;
+float unaccounted_percent;
+
+static const struct
+{
+  const char *name;
+  const unsigned long *kb;
+} breakdown_table[] = {
+  { "mem_anon",               &kb_bd_anon },
+  { "mem_file_active",        &kb_active_file },
+  { "mem_file_inactive",      &kb_inactive_file },
+  { "mem_shmem",              &kb_shmem },
+  { "mem_slab_reclaimable",   &kb_swap_reclaimable },
+  { "mem_slab_unreclaimable", &kb_swap_unreclaimable },
+  { "mem_kernel_stack",       &kb_kernel_stack },
+  { "mem_pagetables",         &kb_bd_pagetables },
+  { "mem_percpu",             &kb_percpu },
+  { "mem_vmalloc",            &kb_vmalloc_used },
+  { "mem_hugetlb",            &kb_bd_hugetlb },
+  { "mem_unevictable",        &kb_unevictable },
+  { "mem_free",               &kb_main_free },
+  { "mem_unaccounted",        &kb_unaccounted },
+};
+
+void
+breakdowninfo (void)
+{
+  unsigned long kb_accounted = 0;
+  size_t i;
+
+  meminfo (CACHE_IS_USED);
+
+  kb_bd_anon = kb_active_anon + kb_inactive_anon;
+  kb_bd_anon -= MIN (kb_shmem, kb_bd_anon);
+  kb_bd_pagetables = kb_pagetables + kb_sec_pagetables;
+  kb_bd_hugetlb = kb_hugetlb ? kb_hugetlb :
+    nr_hugepages_total * kb_hugepagesize;
+
+  /* kb_unaccounted (the last item) is not part of the sum */
+  kb_unaccounted = 0;
+  for (i = 0; i < sizeof (breakdown_table) / sizeof (breakdown_table[0]); i++)
+    kb_accounted += *breakdown_table[i].kb;
+
+  kb_unaccounted = (kb_main_total > kb_accounted) ?
+    kb_main_total - kb_accounted : 0;
+
+  unaccounted_percent = 0;
+  if (kb_main_total != 0)
+    unaccounted_percent = kb_unaccounted * 100.0 / kb_main_total;
+}
+
 char *
-get_swap_perfdata (int shift, const char *units)
+get_breakdown_status (int status, int shift, const char *units)
 {
   char *msg;
   int ret;
 
-  ret = asprintf (&msg,
-                  "swap_total=%Lu%s, swap_used=%Lu%s, swap_free=%Lu%s, "
-                  /* The amount of swap, in kB, used as cache memory */
-                  "swap_cached=%Lu%s, "
-                  "swap_pageins=%Lu%s, swap_pageouts=%Lu%s\n",
-                  SU (kb_swap_total), SU (kb_swap_used), SU (kb_swap_free),
-                  SU (kb_swap_cached),
-                  SU (kb_swap_pageins), SU (kb_swap_pageouts));
+  ret = asprintf (&msg, "%s: %.2f%% (%Lu%s) of the memory unaccounted "
+                  "(mlocked %Lu%s)", state_text (status),
+                  unaccounted_percent, SU (kb_unaccounted), SU (kb_mlocked));
 
   if (ret < 0)
-    die (STATE_UNKNOWN, "Error getting swap perfdata\n");
+    die (STATE_UNKNOWN, "Error getting memory breakdown status\n");
 
   return msg;
 }
+
+void
+get_breakdown_perfdata (perfdata *pd)
+{
+  size_t i;
+
+  perfdata_add (pd, "mem_total", PERFDATA_KB, kb_main_total);
+  for (i = 0; i < sizeof (breakdown_table) / sizeof (breakdown_table[0]); i++)
+    perfdata_add (pd, breakdown_table[i].name, PERFDATA_KB,
+                  *breakdown_table[i].kb);
+  perfdata_add (pd, "mem_mlocked", PERFDATA_KB, kb_mlocked);
+}
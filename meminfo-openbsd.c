@@ -39,6 +39,7 @@
 #include <string.h>
 
 #include "nputils.h"
+#include "meminfo.h"
 
 #define SU(X) ( ((unsigned int)(X) << 10) >> shift ), units
 
@@ -218,44 +219,41 @@ get_swap_status (int status, float percent_used, int shift,
   return msg;
 }
 
-char *
-get_memory_perfdata (int shift, const char *units)
+void
+get_memory_perfdata (perfdata *pd)
 {
-  char *msg;
-  int ret;
-
-  ret = asprintf (&msg,
-                  "mem_total=%d%s, "
-                  "mem_used=%d%s, "
-                  "mem_free=%d%s, "
-                  "mem_cached=%d%s\n",
-                  SU (kb_main_total),
-                  SU (kb_main_used),
-                  SU (kb_main_free),
-                  SU (kb_main_cached));
-
-  if (ret < 0)
-    die (STATE_UNKNOWN, "Error getting memory perfdata\n");
-
-  return msg;
+  static const struct
+  {
+    const char *label;
+    int *kb;
+  } memory_perfdata[] = {
+    { "mem_total",  &kb_main_total },
+    { "mem_used",   &kb_main_used },
+    { "mem_free",   &kb_main_free },
+    { "mem_cached", &kb_main_cached }
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof (memory_perfdata) / sizeof (memory_perfdata[0]); i++)
+    perfdata_add (pd, memory_perfdata[i].label, PERFDATA_KB,
+                  *memory_perfdata[i].kb);
 }
 
-char *
-get_swap_perfdata (int shift, const char *units)
+void
+get_swap_perfdata (perfdata *pd)
 {
-  char *msg;
-  int ret;
-
-  ret = asprintf (&msg,
-                  "swap_total=%d%s, "
-                  "swap_used=%d%s, "
-                  "swap_free=%d%s\n",
-                  SU (kb_swap_total),
-                  SU (kb_swap_used),
-                  SU (kb_swap_free));
-
-  if (ret < 0)
-    die (STATE_UNKNOWN, "Error getting swap perfdata\n");
-
-  return msg;
+  static const struct
+  {
+    const char *label;
+    int *kb;
+  } swap_perfdata[] = {
+    { "swap_total", &kb_swap_total },
+    { "swap_used",  &kb_swap_used },
+    { "swap_free",  &kb_swap_free }
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof (swap_perfdata) / sizeof (swap_perfdata[0]); i++)
+    perfdata_add (pd, swap_perfdata[i].label, PERFDATA_KB,
+                  *swap_perfdata[i].kb);
 }
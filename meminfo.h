@@ -2,19 +2,25 @@
 # define MEMINFO_H_
 
 #include "config.h"
+#include "perfdata.h"
 
 extern MEM_DATATYPE kb_main_used;
 extern MEM_DATATYPE kb_main_total;
 extern MEM_DATATYPE kb_swap_used;
 extern MEM_DATATYPE kb_swap_total;
 
+/* accounting of the reclaimable memory in meminfo () */
+#define CACHE_IS_USED     0
+#define CACHE_IS_FREE     1	/* buffers and page cache (but shmem) */
+#define AVAILABLE_IS_FREE 2	/* linux: the MemAvailable estimate */
+
 void meminfo (int);
 void swapinfo (void);
 
 char *get_memory_status (int, float, int, const char*);
-char *get_memory_perfdata (int, const char*);
+void get_memory_perfdata (perfdata *);
 
 char *get_swap_status (int, float, int, const char*);
-char *get_swap_perfdata (int, const char*);
+void get_swap_perfdata (perfdata *);
 
 #endif
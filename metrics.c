@@ -0,0 +1,311 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * The metrics that can be used in the threshold expressions
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nputils.h"
+#include "meminfo.h"
+#include "metrics.h"
+#ifdef HAVE_LINUX_PROCFS
+# include "vminfo.h"
+#endif
+
+/* the functions filling the metrics */
+#define SRC_MEMORY	0x01
+#define SRC_SWAPRATE	0x02
+#define SRC_RECLAIM	0x04
+#define SRC_THRASHING	0x08
+#define SRC_DIRTY	0x10
+#define SRC_COMMIT	0x20
+#define SRC_SLAB	0x40
+#define SRC_KSM		0x80
+
+enum metric_id
+{
+  MEM_TOTAL,
+  MEM_USED,
+  MEM_FREE,
+  MEM_USED_PCT,
+  SWAP_TOTAL,
+  SWAP_USED,
+  SWAP_FREE,
+  SWAP_USED_PCT,
+#ifdef HAVE_LINUX_PROCFS
+  AVAIL,
+  AVAIL_PCT,
+  BUFFERS,
+  CACHED,
+  SHMEM,
+  DIRTY,
+  WRITEBACK,
+  PSWPIN_RATE,
+  PSWPOUT_RATE,
+  DIRECT_RECLAIM_RATE,
+  RECLAIM_EFFICIENCY,
+  MAJFAULT_RATE,
+  REFAULT_PCT,
+  ACTIVATE_PCT,
+  DIRTY_PCT,
+  COMMIT_PCT,
+  SLAB_UNRECLAIM_PCT,
+  SLAB_UNRECLAIM_GROWTH,
+  KSM_SAVED_PCT,
+#endif
+  METRICS_COUNT
+};
+
+static const struct
+{
+  const char *name;
+  unsigned int source;
+  int unit;			/* the sizes (and size rates) are in bytes */
+} metrics[METRICS_COUNT] = {
+  [MEM_TOTAL]             = { "mem_total",             SRC_MEMORY,    PERFDATA_BYTES },
+  [MEM_USED]              = { "mem_used",              SRC_MEMORY,    PERFDATA_BYTES },
+  [MEM_FREE]              = { "mem_free",              SRC_MEMORY,    PERFDATA_BYTES },
+  [MEM_USED_PCT]          = { "mem_used_pct",          SRC_MEMORY,    PERFDATA_PERCENT },
+  [SWAP_TOTAL]            = { "swap_total",            SRC_MEMORY,    PERFDATA_BYTES },
+  [SWAP_USED]             = { "swap_used",             SRC_MEMORY,    PERFDATA_BYTES },
+  [SWAP_FREE]             = { "swap_free",             SRC_MEMORY,    PERFDATA_BYTES },
+  [SWAP_USED_PCT]         = { "swap_used_pct",         SRC_MEMORY,    PERFDATA_PERCENT },
+#ifdef HAVE_LINUX_PROCFS
+  [AVAIL]                 = { "avail",                 SRC_MEMORY,    PERFDATA_BYTES },
+  [AVAIL_PCT]             = { "avail_pct",             SRC_MEMORY,    PERFDATA_PERCENT },
+  [BUFFERS]               = { "buffers",               SRC_MEMORY,    PERFDATA_BYTES },
+  [CACHED]                = { "cached",                SRC_MEMORY,    PERFDATA_BYTES },
+  [SHMEM]                 = { "shmem",                 SRC_MEMORY,    PERFDATA_BYTES },
+  [DIRTY]                 = { "dirty",                 SRC_MEMORY,    PERFDATA_BYTES },
+  [WRITEBACK]             = { "writeback",             SRC_MEMORY,    PERFDATA_BYTES },
+  [PSWPIN_RATE]           = { "pswpin_rate",           SRC_SWAPRATE,  PERFDATA_NONE },
+  [PSWPOUT_RATE]          = { "pswpout_rate",          SRC_SWAPRATE,  PERFDATA_NONE },
+  [DIRECT_RECLAIM_RATE]   = { "direct_reclaim_rate",   SRC_RECLAIM,   PERFDATA_NONE },
+  [RECLAIM_EFFICIENCY]    = { "reclaim_efficiency",    SRC_RECLAIM,   PERFDATA_PERCENT },
+  [MAJFAULT_RATE]         = { "majfault_rate",         SRC_RECLAIM,   PERFDATA_NONE },
+  [REFAULT_PCT]           = { "refault_pct",           SRC_THRASHING, PERFDATA_PERCENT },
+  [ACTIVATE_PCT]          = { "activate_pct",          SRC_THRASHING, PERFDATA_PERCENT },
+  [DIRTY_PCT]             = { "dirty_pct",             SRC_DIRTY,     PERFDATA_PERCENT },
+  [COMMIT_PCT]            = { "commit_pct",            SRC_COMMIT,    PERFDATA_PERCENT },
+  [SLAB_UNRECLAIM_PCT]    = { "slab_unreclaim_pct",    SRC_SLAB,      PERFDATA_PERCENT },
+  [SLAB_UNRECLAIM_GROWTH] = { "slab_unreclaim_growth", SRC_SLAB,      PERFDATA_NONE },
+  [KSM_SAVED_PCT]         = { "ksm_saved_pct",         SRC_KSM,       PERFDATA_PERCENT },
+#endif
+};
+
+static double metric_values[METRICS_COUNT];
+
+#define KB(X) ((double) (X) * 1024)
+#define PERCENT(X, TOTAL) ((TOTAL) ? (double) (X) * 100 / (TOTAL) : 0)
+
+int
+metrics_lookup (const char *name, size_t len)
+{
+  int i;
+
+  for (i = 0; i < METRICS_COUNT; i++)
+    if (strlen (metrics[i].name) == len &&
+	strncmp (metrics[i].name, name, len) == 0)
+      return i;
+
+  return -1;
+}
+
+/*
+ * Compile the threshold expression 'text' (if not NULL), or exit with
+ * an error message.
+ */
+void
+metrics_compile (expression *expr, const char *text)
+{
+  const char *error;
+  int pos;
+
+  expr->text = NULL;
+  expr->len = 0;
+  if (text == NULL)
+    return;
+
+  if ((pos = expr_compile (expr, text, metrics_lookup, &error)) != 0)
+    die (STATE_UNKNOWN, "Invalid threshold expression '%s': %s at column %d\n",
+	 text, error, pos);
+}
+
+static unsigned int
+metrics_sources (const expression *expr)
+{
+  unsigned int sources = 0;
+  int i;
+
+  for (i = 0; i < expr->len; i++)
+    if (expr->code[i].opcode == EXPR_METRIC)
+      sources |= metrics[expr->code[i].metric].source;
+
+  return sources;
+}
+
+/*
+ * Collect the metrics used by the expressions 'warn' and 'crit'.
+ * The memory (and swap) usage is always read, according to 'cache_is_free'.
+ */
+void
+metricsinfo (int cache_is_free, const expression *warn,
+	     const expression *crit)
+{
+  unsigned int sources = metrics_sources (warn) | metrics_sources (crit);
+
+#ifdef HAVE_LINUX_PROCFS
+  /* commitinfo () reads the memory with the cache counted as used */
+  if (sources & SRC_COMMIT)
+    {
+      commitinfo ();
+      metric_values[COMMIT_PCT] = commit_percent;
+    }
+#else
+  /* the linux meminfo () also reads the swap usage */
+  swapinfo ();
+#endif
+
+  meminfo (cache_is_free);
+
+  metric_values[MEM_TOTAL] = KB (kb_main_total);
+  metric_values[MEM_USED] = KB (kb_main_used);
+  metric_values[MEM_FREE] = KB (kb_main_total - kb_main_used);
+  metric_values[MEM_USED_PCT] = PERCENT (kb_main_used, kb_main_total);
+  metric_values[SWAP_TOTAL] = KB (kb_swap_total);
+  metric_values[SWAP_USED] = KB (kb_swap_used);
+  metric_values[SWAP_FREE] = KB (kb_swap_total - kb_swap_used);
+  metric_values[SWAP_USED_PCT] = PERCENT (kb_swap_used, kb_swap_total);
+
+#ifdef HAVE_LINUX_PROCFS
+  metric_values[AVAIL] = KB (kb_main_available);
+  metric_values[AVAIL_PCT] = PERCENT (kb_main_available, kb_main_total);
+  metric_values[BUFFERS] = KB (kb_main_buffers);
+  metric_values[CACHED] = KB (kb_main_cached);
+  metric_values[SHMEM] = KB (kb_shmem);
+  metric_values[DIRTY] = KB (kb_dirty);
+  metric_values[WRITEBACK] = KB (kb_writeback);
+
+  if (sources & SRC_SWAPRATE)
+    {
+      swaprateinfo ();
+      metric_values[PSWPIN_RATE] = swap_pagein_rate;
+      metric_values[PSWPOUT_RATE] = swap_pageout_rate;
+    }
+  if (sources & SRC_RECLAIM)
+    {
+      reclaiminfo ();
+      metric_values[DIRECT_RECLAIM_RATE] = reclaim_direct_rate;
+      metric_values[RECLAIM_EFFICIENCY] = reclaim_efficiency;
+      metric_values[MAJFAULT_RATE] = reclaim_majfault_rate;
+    }
+  if (sources & SRC_THRASHING)
+    {
+      thrashinginfo ();
+      metric_values[REFAULT_PCT] = thrashing_refault;
+      metric_values[ACTIVATE_PCT] = thrashing_activate;
+    }
+  if (sources & SRC_DIRTY)
+    {
+      dirtyinfo ();
+      metric_values[DIRTY_PCT] = dirty_percent;
+    }
+  if (sources & SRC_SLAB)
+    {
+      slabinfo ();
+      metric_values[SLAB_UNRECLAIM_PCT] = slab_unreclaim_percent;
+      metric_values[SLAB_UNRECLAIM_GROWTH] = KB (slab_unreclaim_growth);
+    }
+  if (sources & SRC_KSM)
+    {
+      ksminfo ();
+      metric_values[KSM_SAVED_PCT] = ksm_saved_percent;
+    }
+#endif
+}
+
+int
+get_metrics_state (const expression *warn, const expression *crit)
+{
+  if (expr_eval (crit, metric_values))
+    return STATE_CRITICAL;
+  if (expr_eval (warn, metric_values))
+    return STATE_WARNING;
+  return STATE_OK;
+}
+
+char *
+get_metrics_status (int status, const expression *warn,
+		    const expression *crit)
+{
+  const expression *matched = NULL;
+  char *msg;
+  int ret;
+
+  if (status == STATE_CRITICAL)
+    matched = crit;
+  else if (status == STATE_WARNING)
+    matched = warn;
+
+  if (matched)
+    ret = asprintf (&msg, "matched '%s'", matched->text);
+  else
+    ret = asprintf (&msg, "no threshold expression matched");
+
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting the metrics status\n");
+
+  return msg;
+}
+
+/* The perfdata of the metrics used by the expressions, but not already
+ * in 'pd' (mem_free, swap_used, ...): a label must appear once
+ */
+void
+get_metrics_perfdata (perfdata *pd, const expression *warn,
+		      const expression *crit)
+{
+  const expression *exprs[] = { warn, crit };
+  char used[METRICS_COUNT] = { 0 };
+  size_t i;
+  int j, k;
+
+  for (i = 0; i < sizeof (exprs) / sizeof (exprs[0]); i++)
+    for (j = 0; j < exprs[i]->len; j++)
+      if (exprs[i]->code[j].opcode == EXPR_METRIC)
+	used[exprs[i]->code[j].metric] = 1;
+
+  for (j = 0; j < METRICS_COUNT; j++)
+    {
+      if (!used[j])
+	continue;
+      for (k = 0; k < pd->count; k++)
+	if (!strcmp (pd->items[k].label, metrics[j].name))
+	  break;
+      if (k == pd->count)
+	perfdata_add (pd, metrics[j].name, metrics[j].unit, metric_values[j]);
+    }
+}
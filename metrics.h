@@ -0,0 +1,14 @@
+#pragma once
+
+#include "expr.h"
+#include "perfdata.h"
+
+/* The metrics that can be used in the threshold expressions */
+
+int metrics_lookup (const char *, size_t);
+void metrics_compile (expression *, const char *);
+void metricsinfo (int, const expression *, const expression *);
+int get_metrics_state (const expression *, const expression *);
+char *get_metrics_status (int, const expression *, const expression *);
+void get_metrics_perfdata (perfdata *, const expression *,
+			   const expression *);
@@ -0,0 +1,70 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * The multi-call binary: check_memory and check_swap in a single program,
+ * selected by the name it is called with
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "nputils.h"
+
+/* the main functions of the plugins, built with -DMULTICALL */
+int check_memory_main (int, char **);
+int check_swap_main (int, char **);
+
+static const struct
+{
+  const char *name;
+  int (*main) (int, char **);
+} plugins[] = {
+  { "check_memory", check_memory_main },
+  { "check_swap",   check_swap_main },
+};
+
+static int
+plugin_index (const char *path)
+{
+  const char *name = strrchr (path, '/');
+  size_t i;
+
+  name = name ? name + 1 : path;
+  for (i = 0; i < sizeof (plugins) / sizeof (plugins[0]); i++)
+    if (!strcmp (name, plugins[i].name))
+      return i;
+
+  return -1;
+}
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  if ((i = plugin_index (argv[0])) >= 0)
+    return plugins[i].main (argc, argv);
+  /* called with another name: the plugin is the first argument */
+  if (argc > 1 && (i = plugin_index (argv[1])) >= 0)
+    return plugins[i].main (argc - 1, argv + 1);
+
+  fprintf (stderr, "Usage: %s check_memory|check_swap [OPTION]...\n",
+	   argv[0]);
+  return STATE_UNKNOWN;
+}
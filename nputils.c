@@ -20,6 +20,10 @@
 
 #include "config.h"
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -31,6 +35,7 @@
 #endif
 
 #include "nputils.h"
+#include "profile.h"
 
 /*
  * Returns TRUE if alert should be raised based on the range 
@@ -199,6 +204,106 @@ set_thresholds (thresholds ** my_thresholds, char *warn_string,
   return 0;
 }
 
+/*
+ * Parse a comma separated list of warning and critical ranges, one for
+ * each of the 'count' metrics checked by a plugin.  An empty (or missing)
+ * item means that the corresponding metric has no threshold.
+ * returns 0 if okay, otherwise 1
+ */
+int
+set_thresholds_list (thresholds ** my_thresholds, int count,
+		     char *warn_string, char *critical_string)
+{
+  char *warn = warn_string ? strdup (warn_string) : NULL;
+  char *crit = critical_string ? strdup (critical_string) : NULL;
+  char *warn_next = warn, *crit_next = crit;
+  char *w, *c;
+  int i, status = 0;
+
+  for (i = 0; i < count; i++)
+    {
+      w = warn_next ? strsep (&warn_next, ",") : NULL;
+      c = crit_next ? strsep (&crit_next, ",") : NULL;
+
+      if (set_thresholds (&my_thresholds[i],
+			  (w && *w) ? w : NULL, (c && *c) ? c : NULL) != 0)
+	{
+	  status = NP_RANGE_UNPARSEABLE;
+	  break;
+	}
+    }
+
+  /* too many items */
+  if (warn_next || crit_next)
+    status = NP_RANGE_UNPARSEABLE;
+
+  free (warn);
+  free (crit);
+
+  return status;
+}
+
+/* see: nagios-plugins-1.4.15/lib/utils_base.c */
+int
+max_state (int a, int b)
+{
+  if (a == STATE_CRITICAL || b == STATE_CRITICAL)
+    return STATE_CRITICAL;
+  else if (a == STATE_WARNING || b == STATE_WARNING)
+    return STATE_WARNING;
+  else if (a == STATE_OK || b == STATE_OK)
+    return STATE_OK;
+  else if (a == STATE_UNKNOWN || b == STATE_UNKNOWN)
+    return STATE_UNKNOWN;
+  else if (a == STATE_DEPENDENT || b == STATE_DEPENDENT)
+    return STATE_DEPENDENT;
+  else
+    return (a > b) ? a : b;
+}
+
+/* Append 'extra' to the plugin message 'msg', preserving its trailing
+ * newline if any.  Both the strings are freed.
+ */
+char *
+append_msg (char *msg, char *extra)
+{
+  char *joined;
+  size_t len = strlen (msg);
+  int newline = (len > 0 && msg[len - 1] == '\n');
+
+  if (newline)
+    msg[--len] = '\0';
+  len = strlen (extra);
+  if (len > 0 && extra[len - 1] == '\n')
+    extra[--len] = '\0';
+
+  if (asprintf (&joined, "%s, %s%s", msg, extra, newline ? "\n" : "") < 0)
+    die (STATE_UNKNOWN, "Error getting the plugin message\n");
+
+  free (msg);
+  free (extra);
+  return joined;
+}
+
+/*
+ * Read the unsigned integer value at the beginning of the (/proc or
+ * /sys) file 'path'.  Returns TRUE on success.
+ */
+int
+read_file_ull (const char *path, unsigned long long *value)
+{
+  double start = profile_start ();
+  FILE *fp;
+  int ret;
+
+  if ((fp = fopen (path, "r")) == NULL)
+    return FALSE;
+  ret = fscanf (fp, "%llu", value);
+  profile_fclose (fp, path, start);
+
+  return (ret == 1);
+}
+
 const char *
 state_text (int result)
 {
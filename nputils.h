@@ -40,9 +40,14 @@ typedef struct thresholds_struct
   range *critical;
 } thresholds;
 
+int check_range (double, range *);
 int get_status (double, thresholds *);
 int set_thresholds (thresholds **, char *, char *);
+int set_thresholds_list (thresholds **, int, char *, char *);
+int max_state (int, int);
 const char *state_text (int);
+char *append_msg (char *, char *);
+int read_file_ull (const char *, unsigned long long *);
 void die (int, const char *, ...)
         attribute_noreturn
         attribute_format_printf(2, 3);
@@ -0,0 +1,371 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A Nagios plugin to check the OOM kills and the memory cgroup events
+ * on linux
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "profile.h"
+#include "state.h"
+#include "vminfo.h"
+
+#define PROC_MOUNTINFO "/proc/self/mountinfo"
+
+/* number of cgroups named in the status message */
+#define OOM_CGROUPS 5
+
+/* the memory.events counters (see Documentation/admin-guide/cgroup-v2.rst):
+ * the processes killed by the OOM killer, the times the usage reached
+ * memory.max and the allocations failed, the usage went over memory.max
+ * (direct reclaim), and over memory.high (throttled)
+ */
+enum oom_event
+{
+  OOM_EVENT_OOM_KILL,
+  OOM_EVENT_OOM,
+  OOM_EVENT_MAX,
+  OOM_EVENT_HIGH,
+  OOM_EVENTS
+};
+
+static const char *oom_event_names[OOM_EVENTS] = {
+  [OOM_EVENT_OOM_KILL] = "oom_kill",
+  [OOM_EVENT_OOM] = "oom",
+  [OOM_EVENT_MAX] = "max",
+  [OOM_EVENT_HIGH] = "high"
+};
+
+typedef struct oom_cgroup_struct
+{
+  char *path;			/* relative to the cgroup2 mount point */
+  int local;			/* memory.events.local: no descendants */
+  unsigned long long events[OOM_EVENTS];	/* since the previous run */
+} oom_cgroup;
+
+static oom_cgroup *oom_cgroups;
+static int oom_cgroups_count;
+static int oom_cgroups_alloc;
+static int oom_cgroups_available;
+
+unsigned long long oom_kills;		/* since the previous run */
+unsigned long long oom_throttled;	/* memory.high and memory.max events */
+static unsigned long long oom_events[OOM_EVENTS];
+
+/* The mount point of the cgroup v2 hierarchy: /sys/fs/cgroup with the
+ * unified layout, /sys/fs/cgroup/unified with the hybrid one
+ */
+static int
+oom_cgroup_root (char *root, size_t size)
+{
+  char line[1024], mnt[PATH_MAX], *sep;
+  double start = profile_start ();
+  int found = FALSE;
+  FILE *fp;
+
+  if ((fp = fopen (PROC_MOUNTINFO, "r")) == NULL)
+    return FALSE;
+
+  while (!found && fgets (line, sizeof line, fp))
+    {
+      /* the optional fields end with a single hyphen */
+      if ((sep = strstr (line, " - cgroup2 ")) == NULL ||
+	  sscanf (line, "%*s %*s %*s %*s %4095s", mnt) != 1)
+	continue;
+      snprintf (root, size, "%s", mnt);
+      found = TRUE;
+    }
+
+  profile_fclose (fp, PROC_MOUNTINFO, start);
+  return found;
+}
+
+/* A 64 bit FNV-1a hash of the cgroup path, for the state file keys */
+static unsigned long long
+oom_hash (const char *str)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+
+  for (; *str; str++)
+    hash = (hash ^ (unsigned char) *str) * 1099511628211ULL;
+
+  return hash;
+}
+
+static int
+oom_read_events (const char *path, unsigned long long *events)
+{
+  char key[32];
+  unsigned long long value;
+  double start = profile_start ();
+  FILE *fp;
+  int i;
+
+  if ((fp = fopen (path, "r")) == NULL)
+    return FALSE;
+
+  memset (events, 0, OOM_EVENTS * sizeof (events[0]));
+  while (fscanf (fp, "%31s %llu", key, &value) == 2)
+    for (i = 0; i < OOM_EVENTS; i++)
+      if (!strcmp (key, oom_event_names[i]))
+	events[i] = value;
+
+  profile_fclose (fp, path, start);
+  return TRUE;
+}
+
+/* Record the counters of the cgroup 'rel', and its new events */
+static void
+oom_cgroup_add (state *st, const char *rel, int local,
+		const unsigned long long *events)
+{
+  oom_cgroup *cg;
+  unsigned long long prev, hash = oom_hash (rel), delta[OOM_EVENTS] = { 0 };
+  char key[64];
+  int i, changed = FALSE;
+
+  for (i = 0; i < OOM_EVENTS; i++)
+    {
+      if (events[i] == 0)
+	continue;
+      snprintf (key, sizeof key, "cg%016llx_%s", hash, oom_event_names[i]);
+      state_set (st, key, events[i]);
+
+      /* a cgroup not in the state file has been created after the
+       * previous run: all its events are new
+       */
+      delta[i] = 0;
+      if (st->timestamp != 0)
+	{
+	  if (!state_get (st, key, &prev) || prev > events[i])
+	    prev = 0;
+	  delta[i] = events[i] - prev;
+	}
+      if (delta[i] > 0)
+	changed = TRUE;
+    }
+
+  if (!changed)
+    return;
+
+  if (oom_cgroups_count == oom_cgroups_alloc)
+    {
+      oom_cgroups_alloc = oom_cgroups_alloc ? oom_cgroups_alloc * 2 : 16;
+      oom_cgroups = realloc (oom_cgroups,
+			     oom_cgroups_alloc * sizeof (oom_cgroup));
+      if (oom_cgroups == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+
+  cg = &oom_cgroups[oom_cgroups_count++];
+  if ((cg->path = strdup (*rel ? rel : "/")) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+  cg->local = local;
+  for (i = 0; i < OOM_EVENTS; i++)
+    cg->events[i] = delta[i];
+}
+
+/* Visit the cgroup 'rel' and its descendants */
+static void
+oom_walk (state *st, const char *root, const char *rel)
+{
+  unsigned long long events[OOM_EVENTS];
+  char path[PATH_MAX];
+  struct dirent *entry;
+  struct stat sb;
+  DIR *dir;
+  int local;
+
+  snprintf (path, sizeof path, "%s/%s/memory.events.local", root, rel);
+  if (!(local = oom_read_events (path, events)))
+    {
+      snprintf (path, sizeof path, "%s/%s/memory.events", root, rel);
+      if (oom_read_events (path, events))
+	local = -1;
+    }
+  if (local)
+    {
+      oom_cgroups_available++;
+      oom_cgroup_add (st, rel, local > 0, events);
+    }
+
+  snprintf (path, sizeof path, "%s/%s", root, rel);
+  if ((dir = opendir (path)) == NULL)
+    return;
+
+  while ((entry = readdir (dir)) != NULL)
+    {
+      if (entry->d_name[0] == '.' ||
+	  (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN))
+	continue;
+      if (*rel)
+	snprintf (path, sizeof path, "%s/%s", rel, entry->d_name);
+      else
+	snprintf (path, sizeof path, "%s", entry->d_name);
+      if (entry->d_type == DT_UNKNOWN &&
+	  (fstatat (dirfd (dir), entry->d_name, &sb, 0) < 0 ||
+	   !S_ISDIR (sb.st_mode)))
+	continue;
+      oom_walk (st, root, path);
+    }
+
+  closedir (dir);
+}
+
+/* Without memory.events.local (kernels older than 5.2) the events of a
+ * cgroup are also counted by all its ancestors: only the deepest cgroup
+ * with new events is reported
+ */
+static int
+oom_cgroup_shadowed (const oom_cgroup *cg)
+{
+  size_t len = strlen (cg->path);
+  int i;
+
+  if (cg->local)
+    return FALSE;
+
+  for (i = 0; i < oom_cgroups_count; i++)
+    if (!strncmp (oom_cgroups[i].path, cg->path, len) &&
+	oom_cgroups[i].path[len] == '/')
+      return TRUE;
+
+  return FALSE;
+}
+
+static int
+compare_oom_cgroups (const void *a, const void *b)
+{
+  const oom_cgroup *ca = a, *cb = b;
+  int i;
+
+  for (i = 0; i < OOM_EVENTS; i++)
+    if (ca->events[i] != cb->events[i])
+      return (ca->events[i] < cb->events[i]) - (ca->events[i] > cb->events[i]);
+
+  return strcmp (ca->path, cb->path);
+}
+
+void
+oominfo (void)
+{
+  unsigned long long prev, cgroup_kills;
+  char root[PATH_MAX];
+  state *st;
+  int i, j;
+
+  vminfo ();
+
+  st = state_open ("check_memory_oom");
+
+  /* oom_kill in /proc/vmstat is 4.13+, and it counts the kills in the
+   * memory cgroups too
+   */
+  oom_kills = 0;
+  state_set (st, "oom_kill", vm_oom_kill);
+  if (state_get (st, "oom_kill", &prev) && prev <= vm_oom_kill)
+    oom_kills = vm_oom_kill - prev;
+
+  if (oom_cgroup_root (root, sizeof root))
+    oom_walk (st, root, "");
+
+  state_save (st);
+  state_free (st);
+
+  for (i = j = 0; i < oom_cgroups_count; i++)
+    if (!oom_cgroup_shadowed (&oom_cgroups[i]))
+      oom_cgroups[j++] = oom_cgroups[i];
+  oom_cgroups_count = j;
+  qsort (oom_cgroups, oom_cgroups_count, sizeof (oom_cgroup),
+	 compare_oom_cgroups);
+
+  memset (oom_events, 0, sizeof oom_events);
+  for (i = 0; i < oom_cgroups_count; i++)
+    for (j = 0; j < OOM_EVENTS; j++)
+      oom_events[j] += oom_cgroups[i].events[j];
+
+  cgroup_kills = oom_events[OOM_EVENT_OOM_KILL];
+  if (cgroup_kills > oom_kills)
+    oom_kills = cgroup_kills;
+  oom_throttled = oom_events[OOM_EVENT_MAX] + oom_events[OOM_EVENT_HIGH];
+}
+
+char *
+get_oom_status (int status)
+{
+  const oom_cgroup *cg;
+  char *msg, *item;
+  int i, j, ret;
+
+  ret = asprintf (&msg, "%s: %llu OOM kills, %llu memory.max and "
+		  "memory.high events since the previous run",
+		  state_text (status), oom_kills, oom_throttled);
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting oom status\n");
+
+  if (oom_cgroups_available == 0)
+    return append_msg (msg, strdup ("no memory cgroup (v2)"));
+
+  for (i = 0; i < oom_cgroups_count && i < OOM_CGROUPS; i++)
+    {
+      cg = &oom_cgroups[i];
+      if (asprintf (&item, "%s", cg->path) < 0)
+	die (STATE_UNKNOWN, "Error getting oom status\n");
+      for (j = 0; j < OOM_EVENTS; j++)
+	if (cg->events[j] > 0)
+	  {
+	    char *tmp = item;
+
+	    if (asprintf (&item, "%s %s=%llu", tmp, oom_event_names[j],
+			  cg->events[j]) < 0)
+	      die (STATE_UNKNOWN, "Error getting oom status\n");
+	    free (tmp);
+	  }
+      msg = append_msg (msg, item);
+    }
+
+  return msg;
+}
+
+void
+get_oom_perfdata (perfdata *pd)
+{
+  int i;
+
+  perfdata_add (pd, "oom_kills", PERFDATA_COUNT, oom_kills);
+  for (i = 0; i < OOM_EVENTS; i++)
+    perfdata_addf (pd, PERFDATA_COUNT, oom_events[i], "cgroup_%s",
+		   oom_event_names[i]);
+  perfdata_add (pd, "cgroups_affected", PERFDATA_COUNT, oom_cgroups_count);
+}
@@ -0,0 +1,478 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Submission of the plugin results as passive checks
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "passive.h"
+#include "perfdata.h"
+#include "state.h"
+
+/* The results waiting for a submission are queued in a file of the state
+ * directory, one for each destination, shared by all the plugins and
+ * locked while in use:
+ *
+ * since 1412243163.621
+ * sent	0	web01	memory
+ * result	1412243163.621	0	web01	swap	SWAP OK: ... | ...
+ *
+ * The 'sent' lines keep the state last submitted for each service, and
+ * the 'result' lines the queued results, in the order of the checks.
+ * The fields are separated by tabs.
+ */
+
+typedef struct passive_entry_struct
+{
+  double time;
+  int status;
+  char *host;
+  char *service;
+  char *output;			/* NULL if already submitted */
+} passive_entry;
+
+typedef struct passive_queue_struct
+{
+  double since;			/* time of the oldest queued result */
+  passive_entry *entries;
+  int count;
+  int alloc;
+  int queued;
+} passive_queue;
+
+static double
+passive_time (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* The tabs and the newlines would break both the queue and the Nagios
+ * formats: the message is flattened on a single line
+ */
+static char *
+passive_field (const char *str)
+{
+  char *field, *s;
+  size_t len;
+
+  if ((field = strdup (str)) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+
+  for (len = strlen (field); len > 0 && strchr (" \t\r\n", field[len - 1]);)
+    field[--len] = '\0';
+  for (s = field; *s; s++)
+    if (*s == '\t' || *s == '\r' || *s == '\n')
+      *s = ' ';
+
+  return field;
+}
+
+static passive_entry *
+passive_add (passive_queue *q, const char *host, const char *service)
+{
+  passive_entry *e;
+
+  if (q->count == q->alloc)
+    {
+      q->alloc = q->alloc ? q->alloc * 2 : 16;
+      q->entries = realloc (q->entries, q->alloc * sizeof (passive_entry));
+      if (q->entries == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+
+  e = &q->entries[q->count++];
+  memset (e, 0, sizeof (passive_entry));
+  e->host = passive_field (host);
+  e->service = passive_field (service);
+
+  return e;
+}
+
+/* Returns the last entry, queued or submitted, of a service */
+static passive_entry *
+passive_find (passive_queue *q, const char *host, const char *service)
+{
+  int i;
+
+  for (i = q->count - 1; i >= 0; i--)
+    if (!strcmp (q->entries[i].host, host) &&
+	!strcmp (q->entries[i].service, service))
+      return &q->entries[i];
+
+  return NULL;
+}
+
+static void
+passive_load (passive_queue *q, FILE *fp)
+{
+  passive_entry *e;
+  char *line = NULL, *s, *field[6];
+  size_t size = 0;
+  ssize_t len;
+  int n;
+
+  if (fscanf (fp, "since %lf\n", &q->since) != 1)
+    return;
+
+  while ((len = getline (&line, &size, fp)) > 0)
+    {
+      if (line[len - 1] == '\n')
+	line[len - 1] = '\0';
+      for (s = line, n = 0; n < 6 && s; n++)
+	field[n] = strsep (&s, "\t");
+
+      if (n == 4 && !strcmp (field[0], "sent"))
+	{
+	  e = passive_add (q, field[2], field[3]);
+	  e->status = atoi (field[1]);
+	}
+      else if (n == 6 && !strcmp (field[0], "result"))
+	{
+	  e = passive_add (q, field[3], field[4]);
+	  e->time = strtod (field[1], NULL);
+	  e->status = atoi (field[2]);
+	  e->output = passive_field (field[5]);
+	  q->queued++;
+	}
+    }
+
+  free (line);
+}
+
+static void
+passive_save (passive_queue *q, FILE *fp, const char *path)
+{
+  passive_entry *e;
+  int i, err;
+
+  rewind (fp);
+  fprintf (fp, "since %.3f\n", q->since);
+  for (i = 0; i < q->count; i++)
+    {
+      e = &q->entries[i];
+      if (e->output)
+	fprintf (fp, "result\t%.3f\t%d\t%s\t%s\t%s\n",
+		 e->time, e->status, e->host, e->service, e->output);
+      else
+	fprintf (fp, "sent\t%d\t%s\t%s\n", e->status, e->host, e->service);
+    }
+
+  err = (fflush (fp) != 0 || ferror (fp));
+  if (err || ftruncate (fileno (fp), ftell (fp)) < 0)
+    die (STATE_UNKNOWN, "Cannot write %s: %s\n", path, strerror (errno));
+}
+
+/* The queued results are now submitted: only the last state of each
+ * service is kept
+ */
+static void
+passive_sent (passive_queue *q)
+{
+  passive_entry *e, *last;
+  int i, count = 0;
+
+  for (i = 0; i < q->count; i++)
+    {
+      e = &q->entries[i];
+      for (last = &q->entries[q->count - 1]; last > e; last--)
+	if (!strcmp (last->host, e->host) &&
+	    !strcmp (last->service, e->service))
+	  break;
+
+      if (last > e)
+	{
+	  free (e->host);
+	  free (e->service);
+	  free (e->output);
+	  continue;
+	}
+
+      free (e->output);
+      e->output = NULL;
+      q->entries[count++] = *e;
+    }
+
+  q->count = count;
+  q->queued = 0;
+}
+
+/*
+ * Write the results in a new file of the checkresults directory 'dir',
+ * in the format of the files of the Nagios check_result_path.  Nagios
+ * only reads the files having a '.ok' companion, created at the end,
+ * so a batch is never read half written.
+ */
+static void
+passive_write_spool (const char *dir, const passive_queue *q)
+{
+  const passive_entry *e;
+  char *path, *ok;
+  FILE *fp;
+  int fd, i, err;
+
+  if (asprintf (&path, "%s/cXXXXXX", dir) < 0)
+    die (STATE_UNKNOWN, "Error getting the check result file name\n");
+
+  if ((fd = mkstemp (path)) < 0 || (fp = fdopen (fd, "w")) == NULL)
+    die (STATE_UNKNOWN, "Cannot create a file in %s: %s\n", dir,
+	 strerror (errno));
+  if (asprintf (&ok, "%s.ok", path) < 0)
+    die (STATE_UNKNOWN, "Error getting the check result file name\n");
+  /* the file is read and then removed by the Nagios user */
+  fchmod (fd, 0644);
+
+  fprintf (fp, "### Passive Check Result File ###\nfile_time=%ld\n\n",
+	   (long) time (NULL));
+  for (i = 0; i < q->count; i++)
+    {
+      e = &q->entries[i];
+      if (e->output == NULL)
+	continue;
+      fprintf (fp, "### Nagios Service Check Result ###\n"
+	       "host_name=%s\nservice_description=%s\n"
+	       "check_type=1\ncheck_options=0\nscheduled_check=0\n"
+	       "reschedule_check=0\nlatency=0.0\n"
+	       "start_time=%ld.%06ld\nfinish_time=%ld.%06ld\n"
+	       "early_timeout=0\nexited_ok=1\nreturn_code=%d\n"
+	       "output=%s\n\n",
+	       e->host, e->service,
+	       (long) e->time, (long) ((e->time - (long) e->time) * 1e6),
+	       (long) e->time, (long) ((e->time - (long) e->time) * 1e6),
+	       e->status, e->output);
+    }
+
+  err = (fflush (fp) != 0 || ferror (fp) || fsync (fd) < 0);
+  if (fclose (fp) != 0 || err)
+    {
+      unlink (path);
+      die (STATE_UNKNOWN, "Cannot write %s: %s\n", path, strerror (errno));
+    }
+
+  if ((fd = open (ok, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0)
+    {
+      unlink (path);
+      die (STATE_UNKNOWN, "Cannot create %s: %s\n", ok, strerror (errno));
+    }
+  close (fd);
+
+  free (path);
+  free (ok);
+}
+
+static void
+passive_write (int fd, const char *path, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  for (; len > 0; buf += n, len -= n)
+    if ((n = write (fd, buf, len)) < 0)
+      {
+	if (errno == EINTR)
+	  n = 0;
+	else
+	  die (STATE_UNKNOWN, "Cannot write %s: %s\n", path,
+	       strerror (errno));
+      }
+}
+
+/*
+ * Write the results as PROCESS_SERVICE_CHECK_RESULT commands in the
+ * external command file 'path'.  The writes in a pipe of at most
+ * PIPE_BUF bytes are atomic: the commands are written in blocks of whole
+ * lines, that cannot be mixed with the commands of the other writers.
+ */
+static void
+passive_write_command_file (const char *path, const passive_queue *q)
+{
+  const passive_entry *e;
+  char buf[PIPE_BUF], *cmd;
+  size_t len = 0;
+  int fd, i, n;
+
+  /* fail instead of blocking when Nagios is not reading the pipe */
+  if ((fd = open (path, O_WRONLY | O_APPEND | O_NONBLOCK)) < 0)
+    die (STATE_UNKNOWN, "Cannot open %s: %s\n", path, strerror (errno));
+  fcntl (fd, F_SETFL, O_APPEND);
+
+  for (i = 0; i < q->count; i++)
+    {
+      e = &q->entries[i];
+      if (e->output == NULL)
+	continue;
+      if ((n = asprintf (&cmd, "[%ld] PROCESS_SERVICE_CHECK_RESULT;"
+			 "%s;%s;%d;%s\n", (long) e->time, e->host,
+			 e->service, e->status, e->output)) < 0)
+	die (STATE_UNKNOWN, "Error getting the external command\n");
+
+      if (len + n > sizeof buf)
+	{
+	  passive_write (fd, path, buf, len);
+	  len = 0;
+	}
+      if ((size_t) n > sizeof buf)
+	passive_write (fd, path, cmd, n);
+      else
+	{
+	  memcpy (buf + len, cmd, n);
+	  len += n;
+	}
+      free (cmd);
+    }
+
+  passive_write (fd, path, buf, len);
+  if (close (fd) < 0)
+    die (STATE_UNKNOWN, "Cannot write %s: %s\n", path, strerror (errno));
+}
+
+/*
+ * Parse the batch size 'COUNT[,SECONDS]'.  Returns -1 if not valid.
+ */
+int
+passive_batch_parse (passive *ps, const char *str)
+{
+  char *end;
+  long count, age = 0;
+
+  count = strtol (str, &end, 10);
+  if (*end == ',')
+    age = strtol (end + 1, &end, 10);
+  if (*end != '\0' || count < 1 || count > INT_MAX || age < 0 ||
+      age > INT_MAX)
+    return -1;
+
+  ps->batch_count = count;
+  ps->batch_age = age;
+  return 0;
+}
+
+/*
+ * Queue the result of the plugin and submit the queued results when the
+ * batch is full, the oldest result has been queued for too long, or the
+ * state of the service has changed.  A result with the same state of
+ * the one still queued for the service replaces it: the server only
+ * receives the state changes and the latest result of each batch.
+ */
+void
+passive_submit (const passive *ps, int status, const char *status_msg,
+		const perfdata *pd, int shift, const char *units)
+{
+  passive_queue q = { 0, NULL, 0, 0, 0 };
+  passive_entry *e, *last;
+  char hostname[256], *host, *service, *path, *msg, *output;
+  unsigned long hash = 5381;
+  const char *s;
+  struct stat st;
+  double now = passive_time ();
+  int fd, submit;
+  FILE *fp;
+
+  if (ps->host == NULL)
+    {
+      if (gethostname (hostname, sizeof hostname) < 0)
+	die (STATE_UNKNOWN, "Cannot get the host name: %s\n",
+	     strerror (errno));
+      hostname[sizeof hostname - 1] = '\0';
+    }
+  host = passive_field (ps->host ? ps->host : hostname);
+  service = passive_field (ps->service);
+
+  /* one queue for each destination */
+  for (s = ps->dest; *s; s++)
+    hash = hash * 33 + (unsigned char) *s;
+  if (asprintf (&path, "%s/passive-%08lx.%u", STATE_DIR, hash & 0xffffffff,
+		(unsigned int) getuid ()) < 0)
+    die (STATE_UNKNOWN, "Error getting the queue file name\n");
+
+  if ((fd = state_file_open (path, O_RDWR | O_CREAT, 0600)) < 0 ||
+      (fp = fdopen (fd, "r+")) == NULL)
+    die (STATE_UNKNOWN, "Cannot open %s: %s\n", path, strerror (errno));
+  if (flock (fd, LOCK_EX) < 0)
+    die (STATE_UNKNOWN, "Cannot lock %s: %s\n", path, strerror (errno));
+
+  passive_load (&q, fp);
+
+  msg = perfdata_nagios (pd, shift, units);
+  last = passive_find (&q, host, service);
+  submit = (last == NULL || last->status != status);
+
+  /* nothing changed: the new result replaces the queued one */
+  if (last && last->output && !submit)
+    {
+      free (last->output);
+      e = last;
+    }
+  else
+    {
+      e = passive_add (&q, host, service);
+      if (q.queued++ == 0)
+	q.since = now;
+    }
+  e->time = now;
+  e->status = status;
+  if (asprintf (&output, "%s | %s", status_msg, msg) < 0)
+    die (STATE_UNKNOWN, "Error getting the passive check result\n");
+  e->output = passive_field (output);
+  free (output);
+  free (msg);
+
+  if (submit || q.queued >= ps->batch_count ||
+      (ps->batch_age > 0 && now - q.since >= ps->batch_age))
+    {
+      if (stat (ps->dest, &st) == 0 && S_ISDIR (st.st_mode))
+	passive_write_spool (ps->dest, &q);
+      else
+	passive_write_command_file (ps->dest, &q);
+      passive_sent (&q);
+      q.since = 0;
+    }
+
+  passive_save (&q, fp, path);
+  fclose (fp);
+
+  for (e = q.entries; e < q.entries + q.count; e++)
+    {
+      free (e->host);
+      free (e->service);
+      free (e->output);
+    }
+  free (q.entries);
+  free (host);
+  free (service);
+  free (path);
+}
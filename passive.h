@@ -0,0 +1,20 @@
+#pragma once
+
+#include "perfdata.h"
+
+/* Submission of the plugin results as passive checks, in batches, to the
+ * Nagios checkresults directory or to the external command file.
+ */
+
+typedef struct passive_struct
+{
+  const char *dest;		/* checkresults directory or command file */
+  const char *host;		/* the host name, if NULL the local one */
+  const char *service;		/* the service description */
+  int batch_count;		/* results queued before a submission */
+  int batch_age;		/* max seconds in the queue, 0: no limit */
+} passive;
+
+int passive_batch_parse (passive *, const char *);
+void passive_submit (const passive *, int, const char *, const perfdata *,
+		     int, const char *);
@@ -0,0 +1,441 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Performance data of the plugins, and its output formats
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "perfdata.h"
+#include "state.h"
+
+void
+perfdata_add (perfdata *pd, const char *label, int unit, double value)
+{
+  if (pd->count == pd->alloc)
+    {
+      pd->alloc = pd->alloc ? pd->alloc * 2 : 32;
+      pd->items = realloc (pd->items, pd->alloc * sizeof (perfdata_item));
+      if (pd->items == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+  if ((pd->items[pd->count].label = strdup (label)) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+  pd->items[pd->count].key = NULL;
+  pd->items[pd->count].instance = NULL;
+  pd->items[pd->count].unit = unit & ~PERFDATA_COUNTER;
+  pd->items[pd->count].counter = (unit & PERFDATA_COUNTER) != 0;
+  pd->items[pd->count].value = value;
+  pd->count++;
+}
+
+/* Add an item with a label built from a format string */
+void
+perfdata_addf (perfdata *pd, int unit, double value, const char *fmt, ...)
+{
+  va_list ap;
+  char *label;
+  int ret;
+
+  va_start (ap, fmt);
+  ret = vasprintf (&label, fmt, ap);
+  va_end (ap);
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting the perfdata label\n");
+
+  perfdata_add (pd, label, unit, value);
+  free (label);
+}
+
+/*
+ * Add an item of the metric 'label' for one of its instances, identified
+ * by the label 'key' (a constant string) in the OpenMetrics format: all
+ * the instances are a single metric family
+ */
+void
+perfdata_add_instance (perfdata *pd, const char *label, const char *key,
+		       const char *instance, int unit, double value)
+{
+  perfdata_item *item;
+
+  perfdata_add (pd, label, unit, value);
+  item = &pd->items[pd->count - 1];
+  item->key = key;
+  if ((item->instance = strdup (instance)) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+}
+
+/*
+ * Returns the output format 'name', or -1 if unknown
+ */
+int
+perfdata_format_parse (const char *name)
+{
+  if (!strcmp (name, "nagios"))
+    return PERFDATA_FORMAT_NAGIOS;
+  if (!strcmp (name, "json"))
+    return PERFDATA_FORMAT_JSON;
+  if (!strcmp (name, "openmetrics"))
+    return PERFDATA_FORMAT_OPENMETRICS;
+  return -1;
+}
+
+static double
+perfdata_bytes (const perfdata_item *item)
+{
+  return (item->unit == PERFDATA_KB) ? item->value * 1024 : item->value;
+}
+
+/*
+ * The perfdata in the Nagios format: space separated 'label=value[uom]'
+ * items, the sizes shown in the unit chosen by the user
+ */
+char *
+perfdata_nagios (const perfdata *pd, int shift, const char *units)
+{
+  const perfdata_item *item;
+  char *msg = NULL;
+  const char *s;
+  size_t size = 0;
+  FILE *fp;
+  int i, printed = 0;
+
+  if ((fp = open_memstream (&msg, &size)) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+
+  for (i = 0; i < pd->count; i++)
+    {
+      item = &pd->items[i];
+
+      /* the instances (the biggest slab caches) change between the runs,
+       * but the graphs of the Nagios perfdata need fixed labels
+       */
+      if (item->instance)
+	continue;
+      if (printed++ > 0)
+	fputc (' ', fp);
+
+      /* the labels with spaces, '=' or quotes must be quoted, and the
+       * quotes doubled
+       */
+      if (strpbrk (item->label, " ='"))
+	{
+	  fputc ('\'', fp);
+	  for (s = item->label; *s; s++)
+	    {
+	      if (*s == '\'')
+		fputc ('\'', fp);
+	      fputc (*s, fp);
+	    }
+	  fputs ("'=", fp);
+	}
+      else
+	fprintf (fp, "%s=", item->label);
+
+      switch (item->unit)
+	{
+	case PERFDATA_KB:
+	case PERFDATA_BYTES:
+	  fprintf (fp, "%lld%s",
+		   (long long) (perfdata_bytes (item) / (1ULL << shift)), units);
+	  break;
+	case PERFDATA_COUNT:
+	  fprintf (fp, "%.0f", item->value);
+	  break;
+	case PERFDATA_PERCENT:
+	  fprintf (fp, "%.2f%%", item->value);
+	  break;
+	case PERFDATA_MS:
+	  fprintf (fp, "%.3fms", item->value);
+	  break;
+	default:
+	  fprintf (fp, "%.2f", item->value);
+	  break;
+	}
+    }
+
+  if (fclose (fp) != 0)
+    die (STATE_UNKNOWN, "Error getting the perfdata\n");
+
+  return msg;
+}
+
+static void
+json_string (FILE *fp, const char *str)
+{
+  fputc ('"', fp);
+  for (; *str; str++)
+    {
+      if (*str == '"' || *str == '\\')
+	fprintf (fp, "\\%c", *str);
+      else if ((unsigned char) *str < 0x20)
+	fprintf (fp, "\\u%04x", (unsigned char) *str);
+      else
+	fputc (*str, fp);
+    }
+  fputc ('"', fp);
+}
+
+static void
+json_number (FILE *fp, double value)
+{
+  if (isfinite (value))
+    fprintf (fp, "%.15g", value);
+  else
+    fputs ("null", fp);
+}
+
+/* The sizes are in bytes */
+static void
+perfdata_print_json (FILE *fp, const char *program, int status,
+		     const char *status_msg, const perfdata *pd)
+{
+  static const char *json_units[] = {
+    [PERFDATA_NONE] = "",
+    [PERFDATA_COUNT] = "",
+    [PERFDATA_KB] = "B",
+    [PERFDATA_BYTES] = "B",
+    [PERFDATA_PERCENT] = "%",
+    [PERFDATA_MS] = "ms"
+  };
+  const perfdata_item *item;
+  int i;
+
+  fputs ("{\"plugin\":", fp);
+  json_string (fp, program);
+  fputs (",\"state\":", fp);
+  json_string (fp, state_text (status));
+  fprintf (fp, ",\"exit_code\":%d,\"message\":", status);
+  json_string (fp, status_msg);
+  fputs (",\"perfdata\":[", fp);
+
+  for (i = 0; i < pd->count; i++)
+    {
+      item = &pd->items[i];
+      fputs (i > 0 ? ",{\"label\":" : "{\"label\":", fp);
+      json_string (fp, item->label);
+      if (item->instance)
+	{
+	  fputs (",\"labels\":{", fp);
+	  json_string (fp, item->key);
+	  fputc (':', fp);
+	  json_string (fp, item->instance);
+	  fputc ('}', fp);
+	}
+      fputs (",\"value\":", fp);
+      json_number (fp, perfdata_bytes (item));
+      fputs (",\"unit\":", fp);
+      json_string (fp, json_units[item->unit]);
+      fputc ('}', fp);
+    }
+
+  fputs ("]}\n", fp);
+}
+
+/* The value of 'item' in the base unit (bytes or seconds), and its unit */
+static double
+openmetrics_value (const perfdata_item *item, const char **unit)
+{
+  switch (item->unit)
+    {
+    case PERFDATA_KB:
+    case PERFDATA_BYTES:
+      *unit = "bytes";
+      return perfdata_bytes (item);
+    case PERFDATA_MS:
+      *unit = "seconds";
+      return item->value / 1000;
+    default:
+      *unit = "";
+      return item->value;
+    }
+}
+
+/* The metric name: the program name, the sanitized label and the unit */
+static char *
+openmetrics_name (const char *program, const perfdata_item *item)
+{
+  const char *unit;
+  char *name, *s;
+
+  openmetrics_value (item, &unit);
+  if (asprintf (&name, "%s_%s%s%s", program, item->label,
+		*unit ? "_" : "", unit) < 0)
+    die (STATE_UNKNOWN, "Error getting the metric name\n");
+  for (s = name; *s; s++)
+    if (!isalnum ((unsigned char) *s))
+      *s = '_';
+
+  return name;
+}
+
+static void
+openmetrics_sample (FILE *fp, const char *name, const perfdata_item *item)
+{
+  const char *unit, *s;
+  double value = openmetrics_value (item, &unit);
+
+  fputs (name, fp);
+  if (item->counter)
+    fputs ("_total", fp);
+  if (item->instance)
+    {
+      fprintf (fp, "{%s=\"", item->key);
+      for (s = item->instance; *s; s++)
+	{
+	  if (*s == '"' || *s == '\\')
+	    fputc ('\\', fp);
+	  if (*s == '\n')
+	    fputs ("\\n", fp);
+	  else
+	    fputc (*s, fp);
+	}
+      fputs ("\"}", fp);
+    }
+  fputc (' ', fp);
+  if (isfinite (value))
+    fprintf (fp, "%.15g\n", value);
+  else
+    fputs ("NaN\n", fp);
+}
+
+/*
+ * The OpenMetrics text format, also accepted by the Prometheus text parser
+ * (of the node_exporter textfile collector): the sizes are in bytes and
+ * the times in seconds, as the Prometheus naming conventions require,
+ * and the samples of the counters have the '_total' suffix.
+ */
+static void
+perfdata_print_openmetrics (FILE *fp, const char *program, int status,
+			    const perfdata *pd)
+{
+  const char *unit;
+  char **names;
+  int i, j;
+
+  fprintf (fp, "# HELP %s_state The plugin state "
+	   "(0: OK, 1: WARNING, 2: CRITICAL, 3: UNKNOWN)\n", program);
+  fprintf (fp, "# TYPE %s_state gauge\n", program);
+  fprintf (fp, "%s_state %d\n", program, status);
+
+  if ((names = calloc (pd->count + 1, sizeof (char *))) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+  for (i = 0; i < pd->count; i++)
+    names[i] = openmetrics_name (program, &pd->items[i]);
+
+  for (i = 0; i < pd->count; i++)
+    {
+      /* a metric family is printed once, with all its instances: skip
+       * the names already seen, also when two labels differ only in the
+       * characters that are sanitized
+       */
+      for (j = 0; j < i; j++)
+	if (!strcmp (names[j], names[i]))
+	  break;
+      if (j < i)
+	continue;
+
+      openmetrics_value (&pd->items[i], &unit);
+      fprintf (fp, "# TYPE %s %s\n", names[i],
+	       pd->items[i].counter ? "counter" : "gauge");
+      if (*unit)
+	fprintf (fp, "# UNIT %s %s\n", names[i], unit);
+
+      openmetrics_sample (fp, names[i], &pd->items[i]);
+      for (j = i + 1; j < pd->count; j++)
+	if (pd->items[j].instance && !strcmp (names[j], names[i]))
+	  openmetrics_sample (fp, names[i], &pd->items[j]);
+    }
+
+  for (i = 0; i < pd->count; i++)
+    free (names[i]);
+  free (names);
+
+  fputs ("# EOF\n", fp);
+}
+
+/*
+ * Print the plugin result in the output 'format'
+ */
+void
+perfdata_print (FILE *fp, int format, const char *program, int status,
+		const char *status_msg, const perfdata *pd,
+		int shift, const char *units)
+{
+  char *msg;
+
+  switch (format)
+    {
+    case PERFDATA_FORMAT_JSON:
+      perfdata_print_json (fp, program, status, status_msg, pd);
+      break;
+    case PERFDATA_FORMAT_OPENMETRICS:
+      perfdata_print_openmetrics (fp, program, status, pd);
+      break;
+    default:
+      msg = perfdata_nagios (pd, shift, units);
+      fprintf (fp, "%s | %s\n", status_msg, msg);
+      free (msg);
+      break;
+    }
+}
+
+/*
+ * Atomically replace the node_exporter textfile 'path' with the metrics
+ * in the OpenMetrics format
+ */
+void
+perfdata_textfile (const char *path, const char *program, int status,
+		   const perfdata *pd)
+{
+  FILE *fp;
+  char *tmp;
+
+  /* readable by node_exporter */
+  fp = state_file_create (path, 0644, &tmp);
+  perfdata_print_openmetrics (fp, program, status, pd);
+  state_file_commit (fp, tmp, path);
+}
+
+void
+perfdata_free (perfdata *pd)
+{
+  int i;
+
+  for (i = 0; i < pd->count; i++)
+    {
+      free (pd->items[i].label);
+      free (pd->items[i].instance);
+    }
+  free (pd->items);
+  pd->items = NULL;
+  pd->count = pd->alloc = 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdio.h>
+
+/* The performance data collected by the plugins, printed in the Nagios
+ * format, as a JSON document or in the OpenMetrics text format.
+ */
+
+enum perfdata_unit
+{
+  PERFDATA_NONE,		/* a rate or a ratio */
+  PERFDATA_COUNT,		/* an integer number (pages, scans) */
+  PERFDATA_KB,			/* a size in kB */
+  PERFDATA_BYTES,		/* a size in bytes */
+  PERFDATA_PERCENT,
+  PERFDATA_MS			/* a time in milliseconds */
+};
+
+/* or'ed with the unit: a counter increasing since the boot */
+#define PERFDATA_COUNTER 0x100
+
+enum perfdata_format
+{
+  PERFDATA_FORMAT_NAGIOS,
+  PERFDATA_FORMAT_JSON,
+  PERFDATA_FORMAT_OPENMETRICS
+};
+
+typedef struct perfdata_item_struct
+{
+  char *label;
+  const char *key;		/* the name of the instance label, if any */
+  char *instance;		/* a slab cache, ... */
+  int unit;
+  int counter;			/* a counter, not a gauge */
+  double value;
+} perfdata_item;
+
+typedef struct perfdata_struct
+{
+  perfdata_item *items;
+  int count;
+  int alloc;
+} perfdata;
+
+void perfdata_add (perfdata *, const char *, int, double);
+void perfdata_addf (perfdata *, int, double, const char *, ...)
+        attribute_format_printf(4, 5);
+void perfdata_add_instance (perfdata *, const char *, const char *,
+			    const char *, int, double);
+int perfdata_format_parse (const char *);
+char *perfdata_nagios (const perfdata *, int, const char *);
+void perfdata_print (FILE *, int, const char *, int, const char *,
+		     const perfdata *, int, const char *);
+void perfdata_textfile (const char *, const char *, int, const perfdata *);
+void perfdata_free (perfdata *);
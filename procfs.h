@@ -0,0 +1,18 @@
+#pragma once
+
+/* linux: the paths of the /proc files read by several modules.  The parser
+ * benchmark (see bench/) is built with PROC_ROOT set to the directory of
+ * the recorded /proc files.
+ */
+
+#ifdef PROC_ROOT
+# undef PROC_MEMINFO
+# define PROC_MEMINFO PROC_ROOT "/meminfo"
+#else
+# define PROC_ROOT "/proc"
+#endif
+
+#define PROC_STAT     PROC_ROOT "/stat"
+#define PROC_SYS_VM   PROC_ROOT "/sys/vm/"
+#define PROC_VMINFO   PROC_ROOT "/vmstat"
+#define PROC_ZONEINFO PROC_ROOT "/zoneinfo"
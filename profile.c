@@ -0,0 +1,216 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Self profiling of the plugins
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nputils.h"
+#include "perfdata.h"
+#include "profile.h"
+
+/* The files are grouped by their first path components, so that the
+ * many files read in a sysfs directory (/sys/kernel/slab/<cache>/...)
+ * are accounted together; the sources beyond PROFILE_SOURCES are
+ * accounted as "other".
+ */
+#define PROFILE_COMPONENTS 3
+#define PROFILE_SOURCES    16
+
+typedef struct profile_source_struct
+{
+  char name[64];
+  double time;
+  unsigned long long bytes;
+} profile_source;
+
+int profile_enabled;
+
+static double profile_begin;
+static profile_source profile_sources[PROFILE_SOURCES];
+static int profile_sources_count;
+
+static double
+profile_now (void)
+{
+  struct timeval tv;
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void
+profile_enable (void)
+{
+  profile_enabled = 1;
+  profile_begin = profile_now ();
+}
+
+/*
+ * Returns the start time of a file read, if the profiling is enabled
+ */
+double
+profile_start (void)
+{
+  return profile_enabled ? profile_now () : 0;
+}
+
+/* The source name: the sanitized first components of 'path' */
+static void
+profile_source_name (char *name, size_t size, const char *path)
+{
+  size_t len = 0;
+  int components = 0;
+
+  for (; *path && len < size - 1; path++)
+    {
+      if (*path == '/')
+	{
+	  if (++components > PROFILE_COMPONENTS)
+	    break;
+	  if (len == 0)
+	    continue;
+	}
+      name[len++] = (*path == '/' || *path == '.' || *path == '-') ?
+	'_' : *path;
+    }
+  name[len] = '\0';
+}
+
+/*
+ * Account 'bytes' read from the file 'path', since the time 'start'
+ */
+void
+profile_read (const char *path, double start, unsigned long long bytes)
+{
+  profile_source *src;
+  char name[64];
+  int i;
+
+  if (!profile_enabled)
+    return;
+
+  profile_source_name (name, sizeof name, path);
+  for (i = 0; i < profile_sources_count; i++)
+    if (!strcmp (profile_sources[i].name, name))
+      break;
+
+  if (i == profile_sources_count)
+    {
+      if (i == PROFILE_SOURCES)
+	{
+	  i = PROFILE_SOURCES - 1;
+	  strcpy (profile_sources[i].name, "other");
+	}
+      else
+	{
+	  strcpy (profile_sources[i].name, name);
+	  profile_sources_count++;
+	}
+    }
+
+  src = &profile_sources[i];
+  src->time += profile_now () - start;
+  src->bytes += bytes;
+}
+
+/*
+ * Close a file read with stdio, accounting the bytes read so far
+ */
+int
+profile_fclose (FILE *fp, const char *path, double start)
+{
+  long bytes;
+
+  if (profile_enabled && (bytes = ftell (fp)) >= 0)
+    profile_read (path, start, bytes);
+
+  return fclose (fp);
+}
+
+/*
+ * Add the profiling data to the perfdata 'pd', at the end of the plugin.
+ * The output is formatted once to measure its cost.
+ */
+void
+get_profile_perfdata (perfdata *pd, int format, const char *program,
+		      int status, const char *status_msg,
+		      int shift, const char *units)
+{
+  double collect, output, read = 0;
+  unsigned long long bytes = 0;
+  struct rusage usage;
+  char *msg = NULL;
+  size_t size = 0;
+  FILE *fp;
+  int i;
+
+  collect = profile_now () - profile_begin;
+
+  if ((fp = open_memstream (&msg, &size)) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+  perfdata_print (fp, format, program, status, status_msg, pd, shift, units);
+  fclose (fp);
+  free (msg);
+  output = profile_now () - profile_begin - collect;
+
+  for (i = 0; i < profile_sources_count; i++)
+    {
+      read += profile_sources[i].time;
+      bytes += profile_sources[i].bytes;
+    }
+
+  perfdata_add (pd, "profile_total", PERFDATA_MS, (collect + output) * 1000);
+  perfdata_add (pd, "profile_read", PERFDATA_MS, read * 1000);
+  perfdata_add (pd, "profile_parse", PERFDATA_MS,
+		(collect > read ? collect - read : 0) * 1000);
+  perfdata_add (pd, "profile_output", PERFDATA_MS, output * 1000);
+  perfdata_add (pd, "profile_read_bytes", PERFDATA_COUNT, bytes);
+
+  for (i = 0; i < profile_sources_count; i++)
+    {
+      perfdata_addf (pd, PERFDATA_MS, profile_sources[i].time * 1000,
+		     "profile_%s", profile_sources[i].name);
+      perfdata_addf (pd, PERFDATA_COUNT, profile_sources[i].bytes,
+		     "profile_%s_bytes", profile_sources[i].name);
+    }
+
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    {
+      perfdata_add (pd, "profile_minflt", PERFDATA_COUNT, usage.ru_minflt);
+      perfdata_add (pd, "profile_majflt", PERFDATA_COUNT, usage.ru_majflt);
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "perfdata.h"
+
+/* Self profiling of the plugins: the time spent reading the /proc and /sys
+ * files, parsing them and formatting the output, and the page faults.
+ */
+
+extern int profile_enabled;
+
+void profile_enable (void);
+double profile_start (void);
+void profile_read (const char *, double, unsigned long long);
+int profile_fclose (FILE *, const char *, double);
+void get_profile_perfdata (perfdata *, int, const char *, int, const char *,
+			   int, const char *);
@@ -0,0 +1,336 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Replay of the memory check on the /proc/meminfo snapshots archived
+ * on disk, in parallel on all the online CPUs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "meminfo.h"
+#include "replay.h"
+#include "vminfo.h"
+
+/* A snapshot begins with the MemTotal line: the snapshots can simply be
+ * concatenated in an archive, and the files without this line (the
+ * /proc/vmstat snapshots, for instance) are skipped.
+ */
+#define SNAPSHOT_KEY     "\nMemTotal:"
+#define SNAPSHOT_KEY_LEN (sizeof (SNAPSHOT_KEY) - 1)
+
+typedef struct replay_file_struct
+{
+  char *path;
+  const char *data;
+  size_t size;
+  long snapshots;
+} replay_file;
+
+typedef struct replay_snapshot_struct
+{
+  const char *data;
+  size_t len;
+  int file;
+  long index;			/* position in the file, from 1 */
+} replay_snapshot;
+
+static replay_file *files;
+static int files_count, files_alloc;
+static replay_snapshot *snapshots;
+static long snapshots_count, snapshots_alloc;
+
+/* The counters of the states, per worker, shared with the workers */
+static long (*states)[STATE_UNKNOWN + 1];
+
+/* The first snapshot in [p, end), or NULL */
+static const char *
+snapshot_start (const char *p, const char *end)
+{
+  if ((size_t) (end - p) >= SNAPSHOT_KEY_LEN - 1 &&
+      !memcmp (p, SNAPSHOT_KEY + 1, SNAPSHOT_KEY_LEN - 1))
+    return p;
+
+  p = memmem (p, end - p, SNAPSHOT_KEY, SNAPSHOT_KEY_LEN);
+  return p ? p + 1 : NULL;
+}
+
+static void
+snapshot_add (const char *data, size_t len, int file, long index)
+{
+  if (snapshots_count == snapshots_alloc)
+    {
+      snapshots_alloc = snapshots_alloc ? snapshots_alloc * 2 : 1024;
+      snapshots = realloc (snapshots,
+			   snapshots_alloc * sizeof (replay_snapshot));
+      if (snapshots == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+  snapshots[snapshots_count].data = data;
+  snapshots[snapshots_count].len = len;
+  snapshots[snapshots_count].file = file;
+  snapshots[snapshots_count].index = index;
+  snapshots_count++;
+}
+
+/* Map the file 'path' and split it in snapshots */
+static void
+replay_file_add (const char *path)
+{
+  const char *data, *start, *next, *end;
+  struct stat st;
+  long index = 0;
+  int fd;
+
+  if ((fd = open (path, O_RDONLY)) < 0 || fstat (fd, &st) < 0)
+    die (STATE_UNKNOWN, "Cannot open %s: %s\n", path, strerror (errno));
+  if (!S_ISREG (st.st_mode) || st.st_size == 0)
+    {
+      close (fd);
+      return;
+    }
+
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    die (STATE_UNKNOWN, "Cannot map %s: %s\n", path, strerror (errno));
+  madvise ((void *) data, st.st_size, MADV_SEQUENTIAL);
+
+  end = data + st.st_size;
+  if ((start = snapshot_start (data, end)) == NULL)
+    {
+      munmap ((void *) data, st.st_size);
+      return;
+    }
+
+  if (files_count == files_alloc)
+    {
+      files_alloc = files_alloc ? files_alloc * 2 : 64;
+      if ((files = realloc (files, files_alloc * sizeof (replay_file))) == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+
+  for (; start; start = next)
+    {
+      next = snapshot_start (start + 1, end);
+      snapshot_add (start, (next ? next : end) - start, files_count, ++index);
+    }
+
+  if ((files[files_count].path = strdup (path)) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+  files[files_count].data = data;
+  files[files_count].size = st.st_size;
+  files[files_count].snapshots = index;
+  files_count++;
+}
+
+/* Add the file 'path', or the files of the directory 'path' (sorted
+ * by name, not recursively) */
+static void
+replay_path_add (const char *path)
+{
+  struct dirent **entries;
+  struct stat st;
+  char *file;
+  int i, n;
+
+  if (stat (path, &st) < 0)
+    die (STATE_UNKNOWN, "Cannot access %s: %s\n", path, strerror (errno));
+  if (!S_ISDIR (st.st_mode))
+    {
+      replay_file_add (path);
+      return;
+    }
+
+  if ((n = scandir (path, &entries, NULL, alphasort)) < 0)
+    die (STATE_UNKNOWN, "Cannot read %s: %s\n", path, strerror (errno));
+  for (i = 0; i < n; i++)
+    {
+      if (entries[i]->d_name[0] != '.')
+	{
+	  if (asprintf (&file, "%s/%s", path, entries[i]->d_name) < 0)
+	    die (STATE_UNKNOWN, "Error getting the snapshot name\n");
+	  replay_file_add (file);
+	  free (file);
+	}
+      free (entries[i]);
+    }
+  free (entries);
+}
+
+/* Check the snapshots [from, to) and write their status to 'out' */
+static void
+replay_snapshots (FILE *out, long from, long to, int cache_is_free,
+		  thresholds *my_thresholds, int shift, const char *units,
+		  long *counters)
+{
+  const replay_snapshot *snap;
+  const replay_file *file;
+  float percent_used;
+  char *status_msg;
+  int status;
+  long i;
+
+  for (i = from; i < to; i++)
+    {
+      snap = &snapshots[i];
+      file = &files[snap->file];
+
+      meminfo_snapshot (snap->data, snap->len, cache_is_free);
+      if (kb_main_total == 0)
+	{
+	  status = STATE_UNKNOWN;
+	  status_msg = strdup ("UNKNOWN: no MemTotal");
+	}
+      else
+	{
+	  percent_used = (kb_main_used * 100.0 / kb_main_total);
+	  status = get_status (percent_used, my_thresholds);
+	  status_msg = get_memory_status (status, percent_used, shift, units);
+	}
+      counters[status]++;
+
+      if (file->snapshots > 1)
+	fprintf (out, "%s:%ld: %s\n", file->path, snap->index, status_msg);
+      else
+	fprintf (out, "%s: %s\n", file->path, status_msg);
+      free (status_msg);
+    }
+}
+
+static double
+replay_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Check all the snapshots of 'path' (a file or a directory), printing
+ * their status in the archive order, followed by a summary.  The
+ * snapshots are split among one worker process per online CPU, that
+ * write their results to temporary files.
+ * Returns the worst state found (UNKNOWN when no snapshot has a state).
+ */
+int
+replay (const char *path, int cache_is_free, thresholds *my_thresholds,
+	int shift, const char *units)
+{
+  long chunk, from, to, total[STATE_UNKNOWN + 1] = { 0 };
+  char copybuf[65536];
+  double start = replay_now (), elapsed;
+  FILE **outputs;
+  pid_t *pids;
+  size_t n;
+  int i, jobs, status, result = STATE_UNKNOWN;
+
+  replay_path_add (path);
+  if (snapshots_count == 0)
+    die (STATE_UNKNOWN, "No /proc/meminfo snapshots found in %s\n", path);
+
+  jobs = sysconf (_SC_NPROCESSORS_ONLN);
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > snapshots_count)
+    jobs = snapshots_count;
+  chunk = (snapshots_count + jobs - 1) / jobs;
+
+  states = mmap (NULL, jobs * sizeof (*states), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  outputs = calloc (jobs, sizeof (FILE *));
+  pids = calloc (jobs, sizeof (pid_t));
+  if (states == MAP_FAILED || outputs == NULL || pids == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+
+  fflush (NULL);
+  for (i = 0; i < jobs; i++)
+    {
+      from = i * chunk;
+      to = (from + chunk < snapshots_count) ? from + chunk : snapshots_count;
+
+      if ((outputs[i] = tmpfile ()) == NULL)
+	die (STATE_UNKNOWN, "Cannot create a temporary file: %s\n",
+	     strerror (errno));
+      if ((pids[i] = fork ()) < 0)
+	die (STATE_UNKNOWN, "Cannot fork: %s\n", strerror (errno));
+      if (pids[i] == 0)
+	{
+	  replay_snapshots (outputs[i], from, to, cache_is_free,
+			    my_thresholds, shift, units, states[i]);
+	  _exit (fclose (outputs[i]) == 0 ? STATE_OK : STATE_UNKNOWN);
+	}
+    }
+
+  for (i = 0; i < jobs; i++)
+    if (waitpid (pids[i], &status, 0) < 0 ||
+	!WIFEXITED (status) || WEXITSTATUS (status) != STATE_OK)
+      die (STATE_UNKNOWN, "A replay worker failed\n");
+  elapsed = replay_now () - start;
+
+  for (i = 0; i < jobs; i++)
+    {
+      rewind (outputs[i]);
+      while ((n = fread (copybuf, 1, sizeof copybuf, outputs[i])) > 0)
+	fwrite (copybuf, 1, n, stdout);
+      fclose (outputs[i]);
+
+      for (status = STATE_OK; status <= STATE_UNKNOWN; status++)
+	{
+	  total[status] += states[i][status];
+	  if (states[i][status])
+	    result = max_state (result, status);
+	}
+    }
+
+  printf ("REPLAY %s: %ld snapshots, %ld ok, %ld warning, %ld critical, "
+	  "%ld unknown | snapshots=%ld elapsed=%.3fs rate=%.0f/s jobs=%d\n",
+	  state_text (result), snapshots_count, total[STATE_OK],
+	  total[STATE_WARNING], total[STATE_CRITICAL], total[STATE_UNKNOWN],
+	  snapshots_count, elapsed, snapshots_count / elapsed, jobs);
+
+  munmap (states, jobs * sizeof (*states));
+  free (outputs);
+  free (pids);
+  for (i = 0; i < files_count; i++)
+    {
+      munmap ((void *) files[i].data, files[i].size);
+      free (files[i].path);
+    }
+  free (files);
+  free (snapshots);
+
+  return result;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "nputils.h"
+
+/* linux: replay of the /proc/meminfo snapshots archived on disk */
+
+int replay (const char *, int, thresholds *, int, const char *);
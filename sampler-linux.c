@@ -0,0 +1,319 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A background sampler of the memory and swap usage on linux, recording
+ * the peaks missed by the plugins between two runs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "meminfo.h"
+#include "nputils.h"
+#include "perfdata.h"
+#include "sampler.h"
+#include "state.h"
+#include "vminfo.h"
+
+/* The samples are aggregated in a ring of buckets of one second, covering
+ * the last hour: the minimum and the maximum of each metric.  The file is
+ * mapped by the sampler, that keeps /proc/meminfo, /proc/stat and
+ * /proc/vmstat open and reads them with pread, and by the plugins.
+ * A bucket is updated under a sequence counter, odd while it's written,
+ * and the readers retry when it changes under them.
+ */
+
+#define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
+
+#define SAMPLER_MAGIC	0x6d656d73	/* "mems" */
+#define SAMPLER_BUCKETS	3600
+
+typedef struct sampler_bucket_struct
+{
+  unsigned int seq;
+  unsigned int samples;
+  long long second;		/* time of the samples (CLOCK_REALTIME) */
+  double min[SAMPLER_METRICS];
+  double max[SAMPLER_METRICS];
+} sampler_bucket;
+
+typedef struct sampler_shared_struct
+{
+  unsigned int magic;
+  unsigned int size;
+  int interval;			/* milliseconds */
+  int pid;
+  sampler_bucket buckets[SAMPLER_BUCKETS];
+} sampler_shared;
+
+static char *
+sampler_path (void)
+{
+  char *path;
+
+  if (asprintf (&path, "%s/check_memory_sampler.%u", STATE_DIR,
+		(unsigned int) getuid ()) < 0)
+    die (STATE_UNKNOWN, "Error getting the state file name\n");
+
+  return path;
+}
+
+static void
+sampler_record (sampler_shared *sh, long long second, const double *values)
+{
+  sampler_bucket *b = &sh->buckets[second % SAMPLER_BUCKETS];
+  int i;
+
+  __atomic_add_fetch (&b->seq, 1, __ATOMIC_ACQ_REL);
+
+  if (b->second != second)
+    {
+      b->second = second;
+      b->samples = 0;
+    }
+  for (i = 0; i < SAMPLER_METRICS; i++)
+    {
+      if (b->samples == 0 || values[i] < b->min[i])
+	b->min[i] = values[i];
+      if (b->samples == 0 || values[i] > b->max[i])
+	b->max[i] = values[i];
+    }
+  b->samples++;
+
+  __atomic_add_fetch (&b->seq, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Sample the memory and swap usage every 'interval' milliseconds, until
+ * killed
+ */
+void
+sampler_run (int interval)
+{
+  double values[SAMPLER_METRICS], elapsed;
+  struct timespec next, now, prev = { 0, 0 };
+  unsigned long prev_pswpin = 0;
+  sampler_shared *sh;
+  char *path = sampler_path ();
+  int fd;
+
+  if ((fd = state_file_open (path, O_RDWR | O_CREAT, 0600)) < 0)
+    die (STATE_UNKNOWN, "Cannot open %s: %s\n", path, strerror (errno));
+  if (flock (fd, LOCK_EX | LOCK_NB) < 0)
+    die (STATE_UNKNOWN, "The sampler is already running (%s)\n", path);
+  if (ftruncate (fd, sizeof (sampler_shared)) < 0)
+    die (STATE_UNKNOWN, "Cannot write %s: %s\n", path, strerror (errno));
+
+  sh = mmap (NULL, sizeof (sampler_shared), PROT_READ | PROT_WRITE,
+	     MAP_SHARED, fd, 0);
+  if (sh == MAP_FAILED)
+    die (STATE_UNKNOWN, "Cannot map %s: %s\n", path, strerror (errno));
+
+  if (sh->magic != SAMPLER_MAGIC || sh->size != sizeof (sampler_shared))
+    {
+      memset (sh, 0, sizeof (sampler_shared));
+      sh->magic = SAMPLER_MAGIC;
+      sh->size = sizeof (sampler_shared);
+    }
+  sh->interval = interval;
+  sh->pid = getpid ();
+
+  clock_gettime (CLOCK_MONOTONIC, &next);
+  for (;;)
+    {
+      meminfo (CACHE_IS_USED);
+      clock_gettime (CLOCK_MONOTONIC, &now);
+
+      values[SAMPLER_MEM_USED] = meminfo_used (CACHE_IS_USED);
+      values[SAMPLER_MEM_USED_CACHES] = meminfo_used (CACHE_IS_FREE);
+      values[SAMPLER_MEM_USED_AVAILABLE] = meminfo_used (AVAILABLE_IS_FREE);
+      values[SAMPLER_SWAP_USED] = kb_swap_used;
+
+      values[SAMPLER_SWAPIN_RATE] = 0;
+      elapsed = (now.tv_sec - prev.tv_sec) +
+	(now.tv_nsec - prev.tv_nsec) / 1e9;
+      if (prev.tv_sec != 0 && elapsed > 0 && kb_swap_pageins >= prev_pswpin)
+	values[SAMPLER_SWAPIN_RATE] = (kb_swap_pageins - prev_pswpin) / elapsed;
+      prev = now;
+      prev_pswpin = kb_swap_pageins;
+
+      sampler_record (sh, time (NULL), values);
+
+      /* absolute deadlines, so that the interval doesn't drift; after a
+       * suspend the missed samples are skipped
+       */
+      next.tv_nsec += (interval % 1000) * 1000000L;
+      next.tv_sec += interval / 1000 + next.tv_nsec / 1000000000L;
+      next.tv_nsec %= 1000000000L;
+      if (next.tv_sec < now.tv_sec)
+	next = now;
+      while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)
+	     == EINTR)
+	;
+    }
+}
+
+/* A consistent copy of the bucket 'b', FALSE if it keeps changing */
+static int
+sampler_bucket_read (const sampler_bucket *b, sampler_bucket *copy)
+{
+  unsigned int seq;
+  int tries;
+
+  for (tries = 0; tries < 100; tries++)
+    {
+      seq = __atomic_load_n (&b->seq, __ATOMIC_ACQUIRE);
+      if (seq & 1)
+	continue;
+      memcpy (copy, b, sizeof (sampler_bucket));
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      if (__atomic_load_n (&b->seq, __ATOMIC_RELAXED) == seq)
+	return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * The minimum and the peak of the metrics since the previous run of the
+ * check 'name' for 'service' (at most the last hour).  Returns FALSE when
+ * there are no samples: the sampler is not running.
+ */
+int
+sampler_peak (const char *name, const char *service, sampler_window *w)
+{
+  const sampler_shared *sh;
+  sampler_bucket b;
+  struct stat sb;
+  long long now, from;
+  char *path = sampler_path (), *key, *p;
+  state *st;
+  int fd, i, j;
+
+  memset (w, 0, sizeof (sampler_window));
+
+  /* the time of the previous run is the one of the state file: one for
+   * each service, that would otherwise move the window of the others
+   */
+  if (asprintf (&key, "%s_%s", name, service) < 0)
+    die (STATE_UNKNOWN, "Error getting the state file name\n");
+  for (p = key + strlen (name) + 1; *p; p++)
+    if (!isalnum ((unsigned char) *p) && *p != '-' && *p != '_')
+      *p = '_';
+  st = state_open (key);
+  free (key);
+  now = time (NULL);
+  from = now - SAMPLER_BUCKETS + 1;
+  if (st->timestamp > from)
+    from = st->timestamp;
+  w->seconds = now - from + 1;
+  state_save (st);
+  state_free (st);
+
+  fd = state_file_open (path, O_RDONLY, 0);
+  free (path);
+  if (fd < 0)
+    return FALSE;
+  /* a shorter file would fault when accessed past its end */
+  if (fstat (fd, &sb) < 0 || sb.st_size < (off_t) sizeof (sampler_shared))
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  sh = mmap (NULL, sizeof (sampler_shared), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (sh == MAP_FAILED)
+    return FALSE;
+
+  if (sh->magic == SAMPLER_MAGIC && sh->size == sizeof (sampler_shared))
+    {
+      w->interval = sh->interval;
+      for (i = 0; i < SAMPLER_BUCKETS; i++)
+	{
+	  if (!sampler_bucket_read (&sh->buckets[i], &b) ||
+	      b.samples == 0 || b.second < from || b.second > now)
+	    continue;
+	  for (j = 0; j < SAMPLER_METRICS; j++)
+	    {
+	      if (w->samples == 0 || b.min[j] < w->min[j])
+		w->min[j] = b.min[j];
+	      if (w->samples == 0 || b.max[j] > w->max[j])
+		w->max[j] = b.max[j];
+	    }
+	  w->samples += b.samples;
+	}
+    }
+
+  munmap ((void *) sh, sizeof (sampler_shared));
+  return w->samples > 0;
+}
+
+/* The peak and the minimum of the size 'metric', as percentage of
+ * 'kb_total'
+ */
+char *
+get_sampler_status (const sampler_window *w, int metric,
+		    unsigned long kb_total, int shift, const char *units)
+{
+  double total = kb_total ? kb_total : 1;
+  char *msg;
+  int ret;
+
+  if (w->samples == 0)
+    ret = asprintf (&msg, "no samples in the last %lds (sampler not "
+		    "running)", w->seconds);
+  else
+    ret = asprintf (&msg, "peak %.2f%% (%Lu%s), min %.2f%% in the last "
+		    "%lds (%lu samples)", w->max[metric] * 100.0 / total,
+		    SU (w->max[metric]), w->min[metric] * 100.0 / total,
+		    w->seconds, w->samples);
+
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting sampler status\n");
+
+  return msg;
+}
+
+void
+get_sampler_perfdata (perfdata *pd, const sampler_window *w, int metric,
+		      const char *label)
+{
+  int unit = (metric == SAMPLER_SWAPIN_RATE) ? PERFDATA_NONE : PERFDATA_KB;
+
+  if (w->samples == 0)
+    return;
+
+  perfdata_addf (pd, unit, w->max[metric], "%s_peak", label);
+  perfdata_addf (pd, unit, w->min[metric], "%s_min", label);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "config.h"
+#include "perfdata.h"
+
+/* linux: the minimum and the peak of the memory and swap usage between two
+ * runs of a plugin, recorded by a background sampler (check_memory
+ * --sampler) in a file of the state directory shared with the plugins.
+ */
+
+enum sampler_metric
+{
+  SAMPLER_MEM_USED,		/* kB, with the CACHE_IS_USED accounting */
+  SAMPLER_MEM_USED_CACHES,	/* kB, CACHE_IS_FREE */
+  SAMPLER_MEM_USED_AVAILABLE,	/* kB, AVAILABLE_IS_FREE */
+  SAMPLER_SWAP_USED,		/* kB */
+  SAMPLER_SWAPIN_RATE,		/* pages swapped in per second */
+  SAMPLER_METRICS
+};
+
+typedef struct sampler_window_struct
+{
+  long seconds;			/* since the previous run of the plugin */
+  unsigned long samples;
+  int interval;			/* of the sampler, in milliseconds */
+  double min[SAMPLER_METRICS];
+  double max[SAMPLER_METRICS];
+} sampler_window;
+
+void sampler_run (int) attribute_noreturn;
+int sampler_peak (const char *, const char *, sampler_window *);
+char *get_sampler_status (const sampler_window *, int, unsigned long, int,
+			  const char *);
+void get_sampler_perfdata (perfdata *, const sampler_window *, int,
+			   const char *);
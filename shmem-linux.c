@@ -0,0 +1,391 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A Nagios plugin to find where the shared memory lives on linux
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "profile.h"
+#include "vminfo.h"
+
+#define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
+
+#define PROC_MOUNTINFO "/proc/self/mountinfo"
+#define PROC_SYSVIPC_SHM "/proc/sysvipc/shm"
+
+/* number of consumers reported in the status message */
+#define SHMEM_TOP 5
+
+enum shmem_kind
+{
+  SHMEM_TMPFS,			/* a tmpfs mount */
+  SHMEM_SYSV,			/* a SysV shared memory segment */
+  SHMEM_MEMFD,			/* a memfd_create() file */
+  SHMEM_DELETED			/* a deleted tmpfs file, still open */
+};
+
+typedef struct shmem_consumer_struct
+{
+  char name[128];
+  int kind;
+  dev_t dev;
+  ino_t ino;
+  unsigned long kb;
+} shmem_consumer;
+
+static shmem_consumer *shmem_consumers;
+static int shmem_consumers_count;
+static int shmem_consumers_alloc;
+
+/* the devices of the tmpfs mounts, for the deleted files */
+static dev_t *shmem_tmpfs_devs;
+static int shmem_tmpfs_count;
+
+extern unsigned long kb_main_total;
+
+float shmem_percent;
+unsigned long kb_shmem_tmpfs;
+unsigned long kb_shmem_sysv;
+unsigned long kb_shmem_memfd;
+unsigned long kb_shmem_unattributed;
+
+static shmem_consumer *
+shmem_consumer_add (int kind, const char *name, unsigned long kb)
+{
+  shmem_consumer *consumer;
+
+  if (shmem_consumers_count == shmem_consumers_alloc)
+    {
+      shmem_consumers_alloc =
+	shmem_consumers_alloc ? shmem_consumers_alloc * 2 : 64;
+      shmem_consumers = realloc (shmem_consumers, shmem_consumers_alloc *
+				 sizeof (shmem_consumer));
+      if (shmem_consumers == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+
+  consumer = &shmem_consumers[shmem_consumers_count++];
+  memset (consumer, 0, sizeof (shmem_consumer));
+  consumer->kind = kind;
+  snprintf (consumer->name, sizeof consumer->name, "%s", name);
+  consumer->kb = kb;
+
+  return consumer;
+}
+
+/*
+ * The tmpfs mounts: the same filesystem can be mounted more than once
+ * (bind mounts), and a mount can be hidden by another one mounted over
+ * it, and then cannot be measured
+ *
+ * 26 25 0:24 / /dev/shm rw,relatime - tmpfs tmpfs rw,size=6158152k
+ */
+static void
+shmem_tmpfs (void)
+{
+  char line[1024], mnt[PATH_MAX], *sep;
+  unsigned int major, minor;
+  double start = profile_start ();
+  struct statvfs vfs;
+  struct stat sb;
+  unsigned long kb;
+  dev_t dev;
+  FILE *fp;
+  int i;
+
+  if ((fp = fopen (PROC_MOUNTINFO, "r")) == NULL)
+    return;
+
+  while (fgets (line, sizeof line, fp))
+    {
+      if ((sep = strstr (line, " - ")) == NULL ||
+	  strncmp (sep, " - tmpfs ", strlen (" - tmpfs ")) ||
+	  sscanf (line, "%*s %*s %u:%u %*s %4095s", &major, &minor, mnt) != 3)
+	continue;
+
+      dev = makedev (major, minor);
+      for (i = 0; i < shmem_tmpfs_count; i++)
+	if (shmem_tmpfs_devs[i] == dev)
+	  break;
+      if (i < shmem_tmpfs_count)
+	continue;
+
+      if (stat (mnt, &sb) < 0 || sb.st_dev != dev || statvfs (mnt, &vfs) < 0)
+	continue;
+
+      shmem_tmpfs_devs = realloc (shmem_tmpfs_devs,
+				  (shmem_tmpfs_count + 1) * sizeof (dev_t));
+      if (shmem_tmpfs_devs == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+      shmem_tmpfs_devs[shmem_tmpfs_count++] = dev;
+
+      kb = (unsigned long long) (vfs.f_blocks - vfs.f_bfree) *
+	vfs.f_frsize / 1024;
+      kb_shmem_tmpfs += kb;
+      if (kb > 0)
+	shmem_consumer_add (SHMEM_TMPFS, mnt, kb);
+    }
+
+  profile_fclose (fp, PROC_MOUNTINFO, start);
+}
+
+/* The SysV shared memory segments; rss and swap are 4.1+, before the
+ * segment size is used:
+ *
+ * key shmid perms size cpid lpid nattch uid gid cuid cgid atime dtime
+ *   ctime rss swap
+ */
+static void
+shmem_sysv (void)
+{
+  char line[512], name[64];
+  unsigned long long size, rss;
+  double start = profile_start ();
+  unsigned long kb;
+  int key, shmid, nattch, n;
+  FILE *fp;
+
+  if ((fp = fopen (PROC_SYSVIPC_SHM, "r")) == NULL)
+    return;
+
+  while (fgets (line, sizeof line, fp))
+    {
+      n = sscanf (line, "%d %d %*o %llu %*d %*d %d %*u %*u %*u %*u %*u %*u "
+		  "%*u %llu", &key, &shmid, &size, &nattch, &rss);
+      if (n < 4)
+	continue;
+
+      kb = ((n == 5) ? rss : size) / 1024;
+      kb_shmem_sysv += kb;
+      snprintf (name, sizeof name, "shmid %d (%d attached)", shmid, nattch);
+      if (kb > 0)
+	shmem_consumer_add (SHMEM_SYSV, name, kb);
+    }
+
+  profile_fclose (fp, PROC_SYSVIPC_SHM, start);
+}
+
+static int
+shmem_is_tmpfs (dev_t dev)
+{
+  int i;
+
+  for (i = 0; i < shmem_tmpfs_count; i++)
+    if (shmem_tmpfs_devs[i] == dev)
+      return TRUE;
+
+  return FALSE;
+}
+
+/* The command name of the process 'pid' */
+static void
+shmem_comm (const char *pid, char *comm, size_t size)
+{
+  char path[64];
+  FILE *fp;
+
+  snprintf (comm, size, "?");
+  snprintf (path, sizeof path, "/proc/%.32s/comm", pid);
+  if ((fp = fopen (path, "r")) == NULL)
+    return;
+  if (fgets (comm, size, fp))
+    comm[strcspn (comm, "\n")] = '\0';
+  fclose (fp);
+}
+
+/*
+ * The memfd files, and the deleted tmpfs files still open, found in the
+ * file descriptors of the processes (all of them only when run by root).
+ * A file open by several processes is accounted once, to the first one;
+ * the memfd mapped but no longer open cannot be found.
+ */
+static void
+shmem_files (void)
+{
+  char path[PATH_MAX], target[PATH_MAX], name[128], comm[32], *end;
+  struct dirent *proc, *fd;
+  shmem_consumer *consumer;
+  DIR *procdir, *fddir;
+  struct stat sb;
+  ssize_t len;
+  int i, kind;
+
+  if ((procdir = opendir ("/proc")) == NULL)
+    return;
+
+  while ((proc = readdir (procdir)) != NULL)
+    {
+      strtol (proc->d_name, &end, 10);
+      if (*end != '\0' || end == proc->d_name)
+	continue;
+
+      snprintf (path, sizeof path, "/proc/%s/fd", proc->d_name);
+      if ((fddir = opendir (path)) == NULL)
+	continue;
+
+      comm[0] = '\0';
+      while ((fd = readdir (fddir)) != NULL)
+	{
+	  if (fd->d_name[0] == '.')
+	    continue;
+	  snprintf (path, sizeof path, "/proc/%s/fd/%s", proc->d_name,
+		    fd->d_name);
+	  if ((len = readlink (path, target, sizeof target - 1)) < 0)
+	    continue;
+	  target[len] = '\0';
+
+	  /* a memfd is always shown as deleted */
+	  kind = -1;
+	  if (len > 10 && !strcmp (target + len - 10, " (deleted)"))
+	    {
+	      target[len - 10] = '\0';
+	      kind = SHMEM_DELETED;
+	    }
+	  if (!strncmp (target, "/memfd:", strlen ("/memfd:")))
+	    kind = SHMEM_MEMFD;
+	  if (kind < 0)
+	    continue;
+
+	  if (stat (path, &sb) < 0 || !S_ISREG (sb.st_mode) ||
+	      (kind == SHMEM_DELETED && !shmem_is_tmpfs (sb.st_dev)))
+	    continue;
+
+	  for (i = 0; i < shmem_consumers_count; i++)
+	    if (shmem_consumers[i].kind == kind &&
+		shmem_consumers[i].dev == sb.st_dev &&
+		shmem_consumers[i].ino == sb.st_ino)
+	      break;
+	  if (i < shmem_consumers_count || sb.st_blocks == 0)
+	    continue;
+
+	  if (comm[0] == '\0')
+	    shmem_comm (proc->d_name, comm, sizeof comm);
+	  snprintf (name, sizeof name, "%.64s (%s[%.16s])",
+		    target + (kind == SHMEM_MEMFD ? 1 : 0), comm, proc->d_name);
+
+	  consumer = shmem_consumer_add (kind, name, sb.st_blocks / 2);
+	  consumer->dev = sb.st_dev;
+	  consumer->ino = sb.st_ino;
+
+	  /* the deleted tmpfs files are already in the tmpfs usage */
+	  if (kind == SHMEM_MEMFD)
+	    kb_shmem_memfd += consumer->kb;
+	}
+
+      closedir (fddir);
+    }
+
+  closedir (procdir);
+}
+
+static int
+compare_shmem_consumers (const void *a, const void *b)
+{
+  unsigned long kb_a = ((const shmem_consumer *) a)->kb;
+  unsigned long kb_b = ((const shmem_consumer *) b)->kb;
+
+  return (kb_a < kb_b) - (kb_a > kb_b);
+}
+
+/*
+ * Must be called after meminfo()
+ */
+void
+shmeminfo (void)
+{
+  unsigned long kb_attributed;
+
+  shmem_tmpfs ();
+  shmem_sysv ();
+  shmem_files ();
+
+  qsort (shmem_consumers, shmem_consumers_count, sizeof (shmem_consumer),
+	 compare_shmem_consumers);
+
+  shmem_percent = 0;
+  if (kb_main_total != 0)
+    shmem_percent = kb_shmem * 100.0 / kb_main_total;
+
+  /* the shared anonymous mappings, the memfd no longer open, and the
+   * tmpfs pages swapped out (counted by statvfs, not by Shmem)
+   */
+  kb_attributed = kb_shmem_tmpfs + kb_shmem_sysv + kb_shmem_memfd;
+  kb_shmem_unattributed =
+    (kb_shmem > kb_attributed) ? kb_shmem - kb_attributed : 0;
+}
+
+char *
+get_shmem_status (int status, int shift, const char *units)
+{
+  static const char *kinds[] = {
+    [SHMEM_TMPFS] = "tmpfs",
+    [SHMEM_SYSV] = "sysv",
+    [SHMEM_MEMFD] = "",
+    [SHMEM_DELETED] = "deleted"
+  };
+  const shmem_consumer *consumer;
+  char *msg, *item;
+  int i;
+
+  if (asprintf (&msg, "%s: %.2f%% (%Lu%s) of shared memory, tmpfs %Lu%s, "
+		"sysv %Lu%s, memfd %Lu%s, unattributed %Lu%s",
+		state_text (status), shmem_percent, SU (kb_shmem),
+		SU (kb_shmem_tmpfs), SU (kb_shmem_sysv), SU (kb_shmem_memfd),
+		SU (kb_shmem_unattributed)) < 0)
+    die (STATE_UNKNOWN, "Error getting shmem status\n");
+
+  for (i = 0; i < shmem_consumers_count && i < SHMEM_TOP; i++)
+    {
+      consumer = &shmem_consumers[i];
+      if (asprintf (&item, "%s%s%s %Lu%s", kinds[consumer->kind],
+		    *kinds[consumer->kind] ? " " : "", consumer->name,
+		    SU (consumer->kb)) < 0)
+	die (STATE_UNKNOWN, "Error getting shmem status\n");
+      msg = append_msg (msg, item);
+    }
+
+  return msg;
+}
+
+void
+get_shmem_perfdata (perfdata *pd)
+{
+  perfdata_add (pd, "mem_shmem", PERFDATA_KB, kb_shmem);
+  perfdata_add (pd, "shmem_tmpfs", PERFDATA_KB, kb_shmem_tmpfs);
+  perfdata_add (pd, "shmem_sysv", PERFDATA_KB, kb_shmem_sysv);
+  perfdata_add (pd, "shmem_memfd", PERFDATA_KB, kb_shmem_memfd);
+  perfdata_add (pd, "shmem_unattributed", PERFDATA_KB,
+		kb_shmem_unattributed);
+}
@@ -0,0 +1,263 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A Nagios plugin to check the slab caches on linux
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "profile.h"
+#include "state.h"
+#include "vminfo.h"
+
+#define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
+
+#define PROC_SLABINFO "/proc/slabinfo"
+#define SYS_SLAB      "/sys/kernel/slab"
+
+/* number of caches reported in the status message */
+#define SLAB_TOP      5
+
+typedef struct slab_cache_struct
+{
+  char name[64];
+  unsigned long kb;
+} slab_cache;
+
+static slab_cache *slab_caches;
+static int slab_caches_count;
+static int slab_caches_alloc;
+static const char *slab_source;
+
+extern unsigned long kb_main_total;
+extern unsigned long kb_slab;
+extern unsigned long kb_swap_unreclaimable;
+
+float slab_unreclaim_percent;
+double slab_unreclaim_growth;	/* kB per hour */
+
+static slab_cache *
+slab_cache_add (const char *name, unsigned long kb)
+{
+  slab_cache *cache;
+
+  if (slab_caches_count == slab_caches_alloc)
+    {
+      slab_caches_alloc = slab_caches_alloc ? slab_caches_alloc * 2 : 128;
+      slab_caches = realloc (slab_caches,
+			     slab_caches_alloc * sizeof (slab_cache));
+      if (slab_caches == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+
+  cache = &slab_caches[slab_caches_count++];
+  snprintf (cache->name, sizeof cache->name, "%s", name);
+  cache->kb = kb;
+
+  return cache;
+}
+
+/* example data (slabinfo version 2.x):
+ *
+ * # name <active_objs> <num_objs> <objsize> <objperslab> <pagesperslab> \
+ *   : tunables <limit> <batchcount> <sharedfactor> \
+ *   : slabdata <active_slabs> <num_slabs> <sharedavail>
+ * dentry 113988 114114 192 21 1 : tunables 0 0 0 : slabdata 5434 5434 0
+ */
+static int
+slabinfo_proc (long kb_page)
+{
+  unsigned long pagesperslab, num_slabs;
+  char line[512], name[64];
+  double start = profile_start ();
+  FILE *fp;
+
+  /* usually readable by root only */
+  if ((fp = fopen (PROC_SLABINFO, "r")) == NULL)
+    return FALSE;
+
+  while (fgets (line, sizeof line, fp))
+    {
+      if (sscanf (line, "%63s %*u %*u %*u %*u %lu : tunables %*u %*u %*u "
+		  ": slabdata %*u %lu", name, &pagesperslab, &num_slabs) != 3)
+	continue;
+      slab_cache_add (name, num_slabs * pagesperslab * kb_page);
+    }
+
+  profile_fclose (fp, PROC_SLABINFO, start);
+  slab_source = PROC_SLABINFO;
+  return TRUE;
+}
+
+/*
+ * SLUB: one directory per cache; the merged caches are named after
+ * their object size (":0000192") and have a symlink for each name.
+ */
+static int
+slabinfo_sys (long kb_page)
+{
+  unsigned long long slabs, order;
+  char path[PATH_MAX], target[PATH_MAX], *base;
+  struct dirent *entry;
+  struct stat sb;
+  DIR *dir;
+  int i;
+
+  if ((dir = opendir (SYS_SLAB)) == NULL)
+    return FALSE;
+
+  while ((entry = readdir (dir)) != NULL)
+    {
+      if (entry->d_name[0] == '.')
+	continue;
+      snprintf (path, sizeof path, SYS_SLAB "/%s", entry->d_name);
+      if (lstat (path, &sb) < 0 || S_ISLNK (sb.st_mode))
+	continue;
+
+      snprintf (path, sizeof path, SYS_SLAB "/%s/slabs", entry->d_name);
+      if (!read_file_ull (path, &slabs))
+	continue;
+      snprintf (path, sizeof path, SYS_SLAB "/%s/order", entry->d_name);
+      if (!read_file_ull (path, &order))
+	order = 0;
+
+      slab_cache_add (entry->d_name, slabs * (kb_page << order));
+    }
+
+  /* give a name to the merged caches */
+  rewinddir (dir);
+  while ((entry = readdir (dir)) != NULL)
+    {
+      ssize_t len;
+
+      snprintf (path, sizeof path, SYS_SLAB "/%s", entry->d_name);
+      if ((len = readlink (path, target, sizeof target - 1)) < 0)
+	continue;
+      target[len] = '\0';
+      base = strrchr (target, '/');
+      base = base ? base + 1 : target;
+
+      for (i = 0; i < slab_caches_count; i++)
+	if (slab_caches[i].name[0] == ':'
+	    && strcmp (slab_caches[i].name, base) == 0)
+	  snprintf (slab_caches[i].name, sizeof slab_caches[i].name, "%.63s",
+		    entry->d_name);
+    }
+
+  closedir (dir);
+  slab_source = SYS_SLAB;
+  return TRUE;
+}
+
+static int
+compare_slab_caches (const void *a, const void *b)
+{
+  unsigned long kb_a = ((const slab_cache *) a)->kb;
+  unsigned long kb_b = ((const slab_cache *) b)->kb;
+
+  return (kb_a < kb_b) - (kb_a > kb_b);
+}
+
+/*
+ * Must be called after meminfo()
+ */
+void
+slabinfo (void)
+{
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+  unsigned long long prev;
+  state *st;
+
+  if (kb_page <= 0)
+    kb_page = 4;
+
+  if (slabinfo_proc (kb_page) || slabinfo_sys (kb_page))
+    qsort (slab_caches, slab_caches_count, sizeof (slab_cache),
+	   compare_slab_caches);
+
+  slab_unreclaim_percent = 0;
+  if (kb_main_total != 0)
+    slab_unreclaim_percent = kb_swap_unreclaimable * 100.0 / kb_main_total;
+
+  /* SUnreclaim can decrease, so the growth can be negative */
+  st = state_open ("check_memory_slab");
+  slab_unreclaim_growth = 0;
+  if (state_get (st, "sunreclaim", &prev) && st->now > st->timestamp)
+    slab_unreclaim_growth = ((double) kb_swap_unreclaimable - (double) prev)
+      * 3600 / (st->now - st->timestamp);
+  state_set (st, "sunreclaim", kb_swap_unreclaimable);
+  state_save (st);
+  state_free (st);
+}
+
+char *
+get_slab_status (int status, int shift, const char *units)
+{
+  char *msg, *item;
+  int i;
+
+  if (asprintf (&msg, "%s: %.2f%% (%Lu%s) of unreclaimable slab, "
+		"growing %.0f%s/h", state_text (status),
+		slab_unreclaim_percent, SU (kb_swap_unreclaimable),
+		slab_unreclaim_growth * 1024 / (1ULL << shift), units) < 0)
+    die (STATE_UNKNOWN, "Error getting slab status\n");
+
+  if (slab_source == NULL)
+    return append_msg (msg, strdup ("slab caches not readable"));
+
+  for (i = 0; i < slab_caches_count && i < SLAB_TOP; i++)
+    {
+      if (asprintf (&item, "%s %Lu%s", slab_caches[i].name,
+		    SU (slab_caches[i].kb)) < 0)
+	die (STATE_UNKNOWN, "Error getting slab status\n");
+      msg = append_msg (msg, item);
+    }
+
+  return msg;
+}
+
+void
+get_slab_perfdata (perfdata *pd)
+{
+  int i;
+
+  perfdata_add (pd, "mem_slab", PERFDATA_KB, kb_slab);
+  perfdata_add (pd, "mem_slab_unreclaimable", PERFDATA_KB,
+		kb_swap_unreclaimable);
+  /* a rate, in bytes per hour as the slab_unreclaim_growth metric */
+  perfdata_add (pd, "mem_slab_unreclaimable_growth", PERFDATA_NONE,
+		slab_unreclaim_growth * 1024);
+
+  for (i = 0; i < slab_caches_count && i < SLAB_TOP; i++)
+    perfdata_add_instance (pd, "slab", "cache", slab_caches[i].name,
+			   PERFDATA_KB, slab_caches[i].kb);
+}
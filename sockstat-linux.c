@@ -0,0 +1,226 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A Nagios plugin to check the memory of the socket buffers on linux
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "profile.h"
+#include "vminfo.h"
+
+#define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
+
+#define PROC_SOCKSTAT  "/proc/net/sockstat"
+#define PROC_SOCKSTAT6 "/proc/net/sockstat6"
+#define PROC_TCP_MEM   "/proc/sys/net/ipv4/tcp_mem"
+#define PROC_UDP_MEM   "/proc/sys/net/ipv4/udp_mem"
+
+/* the counters of /proc/net/sockstat{,6}; the 'mem' ones are in pages and
+ * global, the other ones are per network namespace
+ */
+static unsigned long long sockets_used;
+static unsigned long long tcp_inuse, tcp6_inuse;
+static unsigned long long tcp_orphan, tcp_tw, tcp_alloc, tcp_mem;
+static unsigned long long udp_inuse, udp6_inuse, udp_mem;
+static unsigned long long frag_memory;		/* bytes */
+
+/* the limits of net.ipv4.{tcp,udp}_mem: min, pressure and max, in pages */
+static unsigned long long tcp_mem_limits[3], udp_mem_limits[3];
+
+unsigned long kb_sockets_tcp;
+unsigned long kb_sockets_udp;
+float sockets_tcp_percent;		/* of tcp_mem max */
+float sockets_udp_percent;		/* of udp_mem max */
+int sockets_pressure;			/* over the pressure threshold */
+int sockets_limit;			/* at the max limit */
+
+static const struct sockstat_table_struct
+{
+  const char *proto;
+  const char *name;
+  unsigned long long *value;
+} sockstat_table[] = {
+  { "sockets:", "used",   &sockets_used },
+  { "TCP:",     "inuse",  &tcp_inuse },
+  { "TCP:",     "orphan", &tcp_orphan },
+  { "TCP:",     "tw",     &tcp_tw },
+  { "TCP:",     "alloc",  &tcp_alloc },
+  { "TCP:",     "mem",    &tcp_mem },
+  { "UDP:",     "inuse",  &udp_inuse },
+  { "UDP:",     "mem",    &udp_mem },
+  { "FRAG:",    "memory", &frag_memory },
+  { "TCP6:",    "inuse",  &tcp6_inuse },
+  { "UDP6:",    "inuse",  &udp6_inuse }
+};
+
+/* Each line is a protocol followed by pairs of names and values:
+ * TCP: inuse 5 orphan 0 tw 2 alloc 7 mem 1
+ */
+static int
+sockstat_read (const char *path)
+{
+  char line[256], proto[16], name[16], *p;
+  unsigned long long value;
+  double start = profile_start ();
+  size_t i;
+  FILE *fp;
+  int n;
+
+  if ((fp = fopen (path, "r")) == NULL)
+    return FALSE;
+
+  while (fgets (line, sizeof line, fp))
+    {
+      if (sscanf (line, "%15s%n", proto, &n) != 1)
+	continue;
+      for (p = line + n; sscanf (p, "%15s %llu%n", name, &value, &n) == 2;
+	   p += n)
+	for (i = 0; i < sizeof (sockstat_table) / sizeof (sockstat_table[0]);
+	     i++)
+	  if (!strcmp (proto, sockstat_table[i].proto) &&
+	      !strcmp (name, sockstat_table[i].name))
+	    *sockstat_table[i].value = value;
+    }
+
+  profile_fclose (fp, path, start);
+  return TRUE;
+}
+
+static int
+sockstat_limits (const char *path, unsigned long long *limits)
+{
+  double start = profile_start ();
+  FILE *fp;
+  int ret;
+
+  if ((fp = fopen (path, "r")) == NULL)
+    return FALSE;
+
+  ret = fscanf (fp, "%llu %llu %llu", &limits[0], &limits[1],
+		&limits[2]) == 3;
+  profile_fclose (fp, path, start);
+
+  return ret;
+}
+
+static float
+sockstat_percent (unsigned long long pages, const unsigned long long *limits)
+{
+  if (limits[2] == 0)
+    return 0;
+  return pages * 100.0 / limits[2];
+}
+
+void
+sockstatinfo (void)
+{
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+
+  if (kb_page <= 0)
+    kb_page = 4;
+
+  if (!sockstat_read (PROC_SOCKSTAT))
+    die (STATE_UNKNOWN, "Cannot read %s: %s\n", PROC_SOCKSTAT,
+	 strerror (errno));
+  /* no sockstat6 when IPv6 is disabled */
+  sockstat_read (PROC_SOCKSTAT6);
+
+  if (!sockstat_limits (PROC_TCP_MEM, tcp_mem_limits))
+    memset (tcp_mem_limits, 0, sizeof tcp_mem_limits);
+  if (!sockstat_limits (PROC_UDP_MEM, udp_mem_limits))
+    memset (udp_mem_limits, 0, sizeof udp_mem_limits);
+
+  kb_sockets_tcp = tcp_mem * kb_page;
+  kb_sockets_udp = udp_mem * kb_page;
+  sockets_tcp_percent = sockstat_percent (tcp_mem, tcp_mem_limits);
+  sockets_udp_percent = sockstat_percent (udp_mem, udp_mem_limits);
+
+  /* over the pressure threshold the kernel shrinks the socket buffers,
+   * and at the max limit the allocations fail and the packets are dropped
+   */
+  sockets_pressure =
+    (tcp_mem_limits[1] && tcp_mem >= tcp_mem_limits[1]) ||
+    (udp_mem_limits[1] && udp_mem >= udp_mem_limits[1]);
+  sockets_limit =
+    (tcp_mem_limits[2] && tcp_mem >= tcp_mem_limits[2]) ||
+    (udp_mem_limits[2] && udp_mem >= udp_mem_limits[2]);
+}
+
+char *
+get_sockstat_status (int status, int shift, const char *units)
+{
+  char *msg;
+  int ret;
+
+  ret = asprintf (&msg, "%s: TCP buffers %Lu%s (%.2f%% of tcp_mem max%s), "
+		  "UDP buffers %Lu%s (%.2f%% of udp_mem max%s), "
+		  "%llu orphaned and %llu time-wait TCP sockets",
+		  state_text (status),
+		  SU (kb_sockets_tcp), sockets_tcp_percent,
+		  tcp_mem_limits[1] && tcp_mem >= tcp_mem_limits[1] ?
+		  ", under pressure" : "",
+		  SU (kb_sockets_udp), sockets_udp_percent,
+		  udp_mem_limits[1] && udp_mem >= udp_mem_limits[1] ?
+		  ", under pressure" : "",
+		  tcp_orphan, tcp_tw);
+
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting sockstat status\n");
+
+  return msg;
+}
+
+void
+get_sockstat_perfdata (perfdata *pd)
+{
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+
+  if (kb_page <= 0)
+    kb_page = 4;
+
+  perfdata_add (pd, "sockets_used", PERFDATA_COUNT, sockets_used);
+  perfdata_add (pd, "tcp_inuse", PERFDATA_COUNT, tcp_inuse);
+  perfdata_add (pd, "tcp6_inuse", PERFDATA_COUNT, tcp6_inuse);
+  perfdata_add (pd, "tcp_orphan", PERFDATA_COUNT, tcp_orphan);
+  perfdata_add (pd, "tcp_tw", PERFDATA_COUNT, tcp_tw);
+  perfdata_add (pd, "tcp_alloc", PERFDATA_COUNT, tcp_alloc);
+  perfdata_add (pd, "tcp_mem", PERFDATA_KB, kb_sockets_tcp);
+  perfdata_add (pd, "tcp_mem_pct", PERFDATA_PERCENT, sockets_tcp_percent);
+  perfdata_add (pd, "tcp_mem_pressure", PERFDATA_KB,
+		tcp_mem_limits[1] * kb_page);
+  perfdata_add (pd, "tcp_mem_max", PERFDATA_KB, tcp_mem_limits[2] * kb_page);
+  perfdata_add (pd, "udp_inuse", PERFDATA_COUNT, udp_inuse);
+  perfdata_add (pd, "udp6_inuse", PERFDATA_COUNT, udp6_inuse);
+  perfdata_add (pd, "udp_mem", PERFDATA_KB, kb_sockets_udp);
+  perfdata_add (pd, "udp_mem_pct", PERFDATA_PERCENT, sockets_udp_percent);
+  perfdata_add (pd, "udp_mem_pressure", PERFDATA_KB,
+		udp_mem_limits[1] * kb_page);
+  perfdata_add (pd, "udp_mem_max", PERFDATA_KB, udp_mem_limits[2] * kb_page);
+  perfdata_add (pd, "frag_memory", PERFDATA_BYTES, frag_memory);
+}
@@ -0,0 +1,270 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * Persistence of the counters sampled by the plugins between two runs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "state.h"
+
+/* The state file is a text file:
+ *
+ * timestamp 1412243163.621
+ * pgmajfault 18446
+ * pgscan_direct 0
+ * ...
+ */
+
+static double
+state_time (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+state_add (state_value **values, int *count, int *alloc,
+	   const char *name, unsigned long long value)
+{
+  if (*count == *alloc)
+    {
+      *alloc = *alloc ? *alloc * 2 : 16;
+      *values = realloc (*values, *alloc * sizeof (state_value));
+      if (*values == NULL)
+	die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+    }
+  (*values)[*count].name = strdup (name);
+  (*values)[*count].value = value;
+  (*count)++;
+}
+
+/*
+ * Open the state file 'path' without following the symbolic links.
+ * A file of another user, or writable by the other users, is refused
+ * with EPERM: it could have been planted there.
+ */
+int
+state_file_open (const char *path, int flags, mode_t mode)
+{
+  struct stat sb;
+  int fd;
+
+  if ((fd = open (path, flags | O_NOFOLLOW | O_CLOEXEC, mode)) < 0)
+    return -1;
+
+  if (fstat (fd, &sb) < 0 || !S_ISREG (sb.st_mode) ||
+      sb.st_uid != geteuid () || (sb.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+      close (fd);
+      errno = EPERM;
+      return -1;
+    }
+
+  return fd;
+}
+
+/* The state file 'path' opened for reading, NULL if missing or refused */
+FILE *
+state_file_fopen (const char *path)
+{
+  FILE *fp;
+  int fd;
+
+  if ((fd = state_file_open (path, O_RDONLY, 0)) < 0)
+    return NULL;
+  if ((fp = fdopen (fd, "r")) == NULL)
+    close (fd);
+
+  return fp;
+}
+
+/*
+ * Create a new file, with a unique name in the directory of 'path', that
+ * will replace it with state_file_commit ()
+ */
+FILE *
+state_file_create (const char *path, mode_t mode, char **tmp)
+{
+  FILE *fp;
+  int fd;
+
+  if (asprintf (tmp, "%s.XXXXXX", path) < 0)
+    die (STATE_UNKNOWN, "Error getting the state file name\n");
+
+  if ((fd = mkstemp (*tmp)) < 0)
+    die (STATE_UNKNOWN, "Cannot create %s: %s\n", *tmp, strerror (errno));
+  if (fchmod (fd, mode) < 0 || (fp = fdopen (fd, "w")) == NULL)
+    {
+      unlink (*tmp);
+      die (STATE_UNKNOWN, "Cannot create %s: %s\n", *tmp, strerror (errno));
+    }
+
+  return fp;
+}
+
+/*
+ * Close the file 'fp' created by state_file_create () and atomically
+ * replace 'path' with it
+ */
+void
+state_file_commit (FILE *fp, char *tmp, const char *path)
+{
+  int err = ferror (fp);
+
+  if (fclose (fp) != 0 || err || rename (tmp, path) < 0)
+    {
+      unlink (tmp);
+      die (STATE_UNKNOWN, "Cannot write %s: %s\n", path, strerror (errno));
+    }
+
+  free (tmp);
+}
+
+/*
+ * Load the values saved by the previous run of the check 'name'
+ */
+state *
+state_open (const char *name)
+{
+  state *st;
+  FILE *fp;
+  char key[128];
+  unsigned long long value;
+  int prev_alloc = 0;
+
+  if ((st = calloc (1, sizeof (state))) == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+
+  if (asprintf (&st->path, "%s/%s.%u", STATE_DIR, name,
+		(unsigned int) getuid ()) < 0)
+    die (STATE_UNKNOWN, "Error getting the state file name\n");
+
+  st->now = state_time ();
+
+  if ((fp = state_file_fopen (st->path)) == NULL)
+    return st;
+
+  if (fscanf (fp, "timestamp %lf\n", &st->timestamp) != 1)
+    st->timestamp = 0;
+  else
+    while (fscanf (fp, "%127s %llu\n", key, &value) == 2)
+      state_add (&st->prev, &st->prev_count, &prev_alloc, key, value);
+
+  fclose (fp);
+  return st;
+}
+
+/*
+ * Returns TRUE if a previous value of 'name' is available
+ */
+int
+state_get (state * st, const char *name, unsigned long long *value)
+{
+  int i;
+
+  if (st->timestamp == 0)
+    return FALSE;
+
+  for (i = 0; i < st->prev_count; i++)
+    if (strcmp (st->prev[i].name, name) == 0)
+      {
+	*value = st->prev[i].value;
+	return TRUE;
+      }
+
+  return FALSE;
+}
+
+void
+state_set (state * st, const char *name, unsigned long long value)
+{
+  state_add (&st->next, &st->next_count, &st->next_alloc, name, value);
+}
+
+/*
+ * Record the counter 'name' and compute its rate per second since the
+ * previous run.  Returns FALSE (and a zero rate) when there's no
+ * previous sample or the counter has been reset (by a reboot).
+ */
+int
+state_rate (state * st, const char *name, unsigned long long value,
+	    double *rate)
+{
+  unsigned long long prev;
+  double elapsed = st->now - st->timestamp;
+
+  state_set (st, name, value);
+
+  *rate = 0;
+  if (!state_get (st, name, &prev) || prev > value || elapsed <= 0)
+    return FALSE;
+
+  *rate = (value - prev) / elapsed;
+  return TRUE;
+}
+
+/*
+ * Atomically replace the state file with the current values
+ */
+void
+state_save (state * st)
+{
+  FILE *fp;
+  char *tmp;
+  int i;
+
+  fp = state_file_create (st->path, 0600, &tmp);
+
+  fprintf (fp, "timestamp %.3f\n", st->now);
+  for (i = 0; i < st->next_count; i++)
+    fprintf (fp, "%s %llu\n", st->next[i].name, st->next[i].value);
+
+  state_file_commit (fp, tmp, st->path);
+}
+
+void
+state_free (state * st)
+{
+  int i;
+
+  for (i = 0; i < st->prev_count; i++)
+    free (st->prev[i].name);
+  for (i = 0; i < st->next_count; i++)
+    free (st->next[i].name);
+  free (st->prev);
+  free (st->next);
+  free (st->path);
+  free (st);
+}
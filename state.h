@@ -0,0 +1,41 @@
+#pragma once
+
+#include <sys/types.h>
+#include <stdio.h>
+
+/* The counters saved by the previous run of a plugin, used for computing
+ * the rates of the kernel counters.
+ */
+
+typedef struct state_value_struct
+{
+  char *name;
+  unsigned long long value;
+} state_value;
+
+typedef struct state_struct
+{
+  char *path;
+  double timestamp;		/* time of the previous sample, 0 if none */
+  double now;			/* time of the current sample */
+  state_value *prev;		/* values read from the state file */
+  int prev_count;
+  state_value *next;		/* values to be saved */
+  int next_count;
+  int next_alloc;
+} state;
+
+/* the files of the state directory: refused if not owned by the user, and
+ * replaced atomically
+ */
+int state_file_open (const char *, int, mode_t);
+FILE *state_file_fopen (const char *);
+FILE *state_file_create (const char *, mode_t, char **);
+void state_file_commit (FILE *, char *, const char *);
+
+state *state_open (const char *);
+int state_get (state *, const char *, unsigned long long *);
+void state_set (state *, const char *, unsigned long long);
+int state_rate (state *, const char *, unsigned long long, double *);
+void state_save (state *);
+void state_free (state *);
@@ -0,0 +1,408 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A Nagios plugin to check the swap devices on linux, zram and zswap
+ * included
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "profile.h"
+#include "state.h"
+#include "swapdev.h"
+
+#define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
+
+#define PROC_SWAPS        "/proc/swaps"
+#define PROC_DISKSTATS    "/proc/diskstats"
+#define SYS_ZSWAP         "/sys/kernel/debug/zswap"
+#define SYS_ZSWAP_ENABLED "/sys/module/zswap/parameters/enabled"
+
+extern unsigned long kb_main_total;
+extern unsigned long kb_zswap;
+extern unsigned long kb_zswapped;
+
+swap_device *swap_devices;
+int swap_devices_count;
+
+unsigned long kb_compressed_swap;
+float compressed_swap_percent;
+
+/* zswap, when the data is available */
+static int zswap_enabled;
+static unsigned long kb_zswap_pool;
+static unsigned long kb_zswap_stored;
+
+/* example data:
+ *
+ * Filename          Type        Size     Used    Priority
+ * /dev/sda2         partition   2096444  895104  -2
+ * /swapfile         file        1048572  0       -3
+ * /dev/zram0        partition   4194300  310272  100
+ */
+
+/* The perfdata label of the 'count' device: the sanitized base name of
+ * the file, numbered when already used (/dev/sda2 and /swap/sda2)
+ */
+static char *
+swapdev_label (const char *filename, int count)
+{
+  const char *base = strrchr (filename, '/');
+  char *name, *label, *p;
+  int i, n = 1;
+
+  name = strdup (base ? base + 1 : filename);
+  if (name == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+  for (p = name; *p; p++)
+    if (!isalnum ((unsigned char) *p))
+      *p = '_';
+
+  label = strdup (name);
+  for (i = 0; label && i < count; i++)
+    if (!strcmp (swap_devices[i].name, label))
+      {
+	free (label);
+	if (asprintf (&label, "%s_%d", name, ++n) < 0)
+	  label = NULL;
+	i = -1;
+      }
+  if (label == NULL)
+    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n", strerror (errno));
+
+  free (name);
+  return label;
+}
+
+/* The block device of the swap area: the device itself for a swap
+ * partition, the one of the filesystem for a swap file
+ */
+static int
+swapdev_blockdev (swap_device * dev)
+{
+  struct stat sb;
+
+  if (stat (dev->filename, &sb) < 0)
+    return FALSE;
+
+  if (S_ISBLK (sb.st_mode))
+    {
+      dev->major = major (sb.st_rdev);
+      dev->minor = minor (sb.st_rdev);
+    }
+  else
+    {
+      dev->major = major (sb.st_dev);
+      dev->minor = minor (sb.st_dev);
+    }
+
+  return S_ISBLK (sb.st_mode);
+}
+
+/*
+ * /sys/dev/block/<major>:<minor>/mm_stat of a zram device (kernel 4.1+):
+ * orig_data_size compr_data_size mem_used_total mem_limit mem_used_max ...
+ * Returns FALSE if the block device is not a zram one.
+ */
+static int
+zraminfo (swap_device * dev)
+{
+  char *path;
+  double start;
+  FILE *fp;
+
+  if (asprintf (&path, "/sys/dev/block/%u:%u/mm_stat", dev->major,
+		dev->minor) < 0)
+    die (STATE_UNKNOWN, "Error getting zram statistics\n");
+
+  start = profile_start ();
+  if ((fp = fopen (path, "r")) == NULL)
+    {
+      free (path);
+      return FALSE;
+    }
+
+  if (fscanf (fp, "%llu %llu %llu", &dev->orig_data_size,
+	      &dev->compr_data_size, &dev->mem_used_total) != 3)
+    dev->orig_data_size = dev->compr_data_size = dev->mem_used_total = 0;
+  profile_fclose (fp, path, start);
+
+  free (path);
+  return TRUE;
+}
+
+/*
+ * Average latency of the I/O operations completed by the block device
+ * holding the swap area since the previous run, from /proc/diskstats:
+ * major minor name reads merged sectors ms_reading writes merged
+ * sectors ms_writing ...
+ */
+static void
+diskinfo (state * st, swap_device * dev)
+{
+  unsigned int major, minor;
+  unsigned long long rd, rd_ms, wr, wr_ms, ios, ticks, prev_ios, prev_ticks;
+  char name[64], *key;
+  char line[256];
+  double start;
+  FILE *fp;
+
+  start = profile_start ();
+  if ((fp = fopen (PROC_DISKSTATS, "r")) == NULL)
+    return;
+
+  while (fgets (line, sizeof line, fp))
+    {
+      if (sscanf (line, "%u %u %63s %llu %*u %*u %llu %llu %*u %*u %llu",
+		  &major, &minor, name, &rd, &rd_ms, &wr, &wr_ms) != 7)
+	continue;
+      if (major != dev->major || minor != dev->minor)
+	continue;
+
+      ios = rd + wr;
+      ticks = rd_ms + wr_ms;
+
+      /* keyed by block device, the labels can change with the order of
+       * the swap areas
+       */
+      if (asprintf (&key, "dev_%u_%u_ios", major, minor) < 0)
+	die (STATE_UNKNOWN, "Error getting disk statistics\n");
+      dev->has_latency = state_get (st, key, &prev_ios);
+      state_set (st, key, ios);
+      free (key);
+
+      if (asprintf (&key, "dev_%u_%u_ticks", major, minor) < 0)
+	die (STATE_UNKNOWN, "Error getting disk statistics\n");
+      dev->has_latency &= state_get (st, key, &prev_ticks);
+      state_set (st, key, ticks);
+      free (key);
+
+      dev->latency = 0;
+      if (dev->has_latency && ios > prev_ios && ticks >= prev_ticks)
+	dev->latency = (double) (ticks - prev_ticks) / (ios - prev_ios);
+      break;
+    }
+
+  profile_fclose (fp, PROC_DISKSTATS, start);
+}
+
+static void
+zswapinfo (void)
+{
+  unsigned long long value;
+  char enabled = 'N';
+  double start = profile_start ();
+  FILE *fp;
+
+  if ((fp = fopen (SYS_ZSWAP_ENABLED, "r")) != NULL)
+    {
+      if (fscanf (fp, " %c", &enabled) != 1)
+	enabled = 'N';
+      profile_fclose (fp, SYS_ZSWAP_ENABLED, start);
+    }
+  zswap_enabled = (enabled == 'Y' || enabled == '1');
+
+  /* 5.19+ kernels report the zswap usage in /proc/meminfo */
+  kb_zswap_pool = kb_zswap;
+  kb_zswap_stored = kb_zswapped;
+
+  /* otherwise debugfs is required (and readable by root only) */
+  if (!kb_zswap_pool && read_file_ull (SYS_ZSWAP "/pool_total_size", &value))
+    kb_zswap_pool = value >> 10;
+  if (!kb_zswap_stored && read_file_ull (SYS_ZSWAP "/stored_pages", &value))
+    kb_zswap_stored = value * (sysconf (_SC_PAGESIZE) >> 10);
+}
+
+/*
+ * Must be called after swapinfo()
+ */
+void
+swapdevinfo (void)
+{
+  swap_device *dev;
+  char filename[4096], type[16];
+  unsigned long size, used;
+  int i, priority, alloc = 0;
+  FILE *fp;
+  state *st;
+
+  if ((fp = fopen (PROC_SWAPS, "r")) == NULL)
+    die (STATE_UNKNOWN, "Error: /proc must be mounted\n");
+
+  st = state_open ("check_swap_devices");
+
+  /* skip the header */
+  if (fscanf (fp, "%*[^\n]\n") == EOF)
+    die (STATE_UNKNOWN, "Error reading %s\n", PROC_SWAPS);
+  while (fscanf (fp, "%4095s %15s %lu %lu %d\n",
+		 filename, type, &size, &used, &priority) == 5)
+    {
+      if (swap_devices_count == alloc)
+	{
+	  alloc = alloc ? alloc * 2 : 4;
+	  swap_devices = realloc (swap_devices, alloc * sizeof (swap_device));
+	  if (swap_devices == NULL)
+	    die (STATE_UNKNOWN, "Cannot allocate memory: %s\n",
+		 strerror (errno));
+	}
+
+      dev = &swap_devices[swap_devices_count++];
+      memset (dev, 0, sizeof (swap_device));
+      dev->filename = strdup (filename);
+      dev->name = swapdev_label (filename, swap_devices_count - 1);
+      strcpy (dev->type, type);
+      dev->kb_size = size;
+      dev->kb_used = used;
+      dev->priority = priority;
+
+      /* a swap file lives on a filesystem, never on a zram device */
+      if (swapdev_blockdev (dev))
+	dev->zram = zraminfo (dev);
+
+      if (dev->zram)
+	kb_compressed_swap += dev->mem_used_total >> 10;
+      else if (dev->major || dev->minor)
+	{
+	  /* the swap files of a filesystem share the latency of its device */
+	  for (i = 0; i < swap_devices_count - 1; i++)
+	    if (swap_devices[i].major == dev->major &&
+		swap_devices[i].minor == dev->minor && !swap_devices[i].zram)
+	      break;
+	  if (i < swap_devices_count - 1)
+	    {
+	      dev->has_latency = swap_devices[i].has_latency;
+	      dev->latency = swap_devices[i].latency;
+	    }
+	  else
+	    diskinfo (st, dev);
+	}
+    }
+  /* the devices are read while parsing /proc/swaps: only its size
+   * is accounted, not to count their read time twice */
+  profile_fclose (fp, PROC_SWAPS, profile_start ());
+
+  state_save (st);
+  state_free (st);
+
+  zswapinfo ();
+  kb_compressed_swap += kb_zswap_pool;
+
+  compressed_swap_percent = 0;
+  if (kb_main_total != 0)
+    compressed_swap_percent = kb_compressed_swap * 100.0 / kb_main_total;
+}
+
+char *
+get_swapdev_status (int status, int shift, const char *units)
+{
+  swap_device *dev;
+  char *msg, *item;
+  int i, ret;
+
+  ret = asprintf (&msg, "%s: compressed swap uses %.2f%% of RAM (%Lu%s)",
+		  state_text (status), compressed_swap_percent,
+		  SU (kb_compressed_swap));
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting swap devices status\n");
+
+  for (i = 0; i < swap_devices_count; i++)
+    {
+      dev = &swap_devices[i];
+      if (dev->zram)
+	ret = asprintf (&item, "%s %.2f%% used (prio %d, ratio %.2f)",
+			dev->filename,
+			dev->kb_size ? dev->kb_used * 100.0 / dev->kb_size : 0,
+			dev->priority,
+			dev->compr_data_size ?
+			(double) dev->orig_data_size / dev->compr_data_size : 0);
+      else
+	ret = asprintf (&item, "%s %.2f%% used (prio %d, %s)",
+			dev->filename,
+			dev->kb_size ? dev->kb_used * 100.0 / dev->kb_size : 0,
+			dev->priority, dev->type);
+      if (ret < 0)
+	die (STATE_UNKNOWN, "Error getting swap devices status\n");
+      msg = append_msg (msg, item);
+    }
+
+  if (zswap_enabled || kb_zswap_pool)
+    {
+      ret = asprintf (&item, "zswap %Lu%s (ratio %.2f)",
+		      SU (kb_zswap_pool),
+		      kb_zswap_pool ?
+		      (double) kb_zswap_stored / kb_zswap_pool : 0);
+      if (ret < 0)
+	die (STATE_UNKNOWN, "Error getting swap devices status\n");
+      msg = append_msg (msg, item);
+    }
+
+  return msg;
+}
+
+void
+get_swapdev_perfdata (perfdata *pd)
+{
+  swap_device *dev;
+  int i;
+
+  perfdata_add (pd, "swap_compressed", PERFDATA_KB, kb_compressed_swap);
+  perfdata_add (pd, "swap_compressed_pct", PERFDATA_PERCENT,
+		compressed_swap_percent);
+
+  for (i = 0; i < swap_devices_count; i++)
+    {
+      dev = &swap_devices[i];
+      perfdata_addf (pd, PERFDATA_KB, dev->kb_size, "swap_%s_size",
+		     dev->name);
+      perfdata_addf (pd, PERFDATA_KB, dev->kb_used, "swap_%s_used",
+		     dev->name);
+
+      if (dev->zram)
+	{
+	  perfdata_addf (pd, PERFDATA_BYTES, dev->orig_data_size,
+			 "%s_orig_data", dev->name);
+	  perfdata_addf (pd, PERFDATA_BYTES, dev->compr_data_size,
+			 "%s_compr_data", dev->name);
+	  perfdata_addf (pd, PERFDATA_BYTES, dev->mem_used_total,
+			 "%s_mem_used", dev->name);
+	}
+      else if (dev->has_latency)
+	perfdata_addf (pd, PERFDATA_MS, dev->latency, "%s_latency",
+		       dev->name);
+    }
+
+  if (zswap_enabled || kb_zswap_pool)
+    {
+      perfdata_add (pd, "zswap_pool", PERFDATA_KB, kb_zswap_pool);
+      perfdata_add (pd, "zswap_stored", PERFDATA_KB, kb_zswap_stored);
+    }
+}
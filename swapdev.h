@@ -0,0 +1,36 @@
+#ifndef SWAPDEV_H_
+# define SWAPDEV_H_
+
+#include "perfdata.h"
+
+/* linux: swap devices (/proc/swaps), zram and zswap */
+
+typedef struct swap_device_struct
+{
+  char *filename;
+  char *name;			/* perfdata label */
+  char type[16];		/* partition or file */
+  unsigned long kb_size;
+  unsigned long kb_used;
+  int priority;
+  unsigned int major, minor;	/* of the block device holding it */
+  int zram;			/* TRUE for a compressed swap in RAM */
+  unsigned long long orig_data_size;	/* bytes, before compression */
+  unsigned long long compr_data_size;
+  unsigned long long mem_used_total;	/* bytes of RAM actually used */
+  int has_latency;		/* TRUE for a disk backed swap */
+  double latency;		/* average I/O latency in ms */
+} swap_device;
+
+extern swap_device *swap_devices;
+extern int swap_devices_count;
+
+/* RAM consumed by the compressed swap (zram and zswap) */
+extern unsigned long kb_compressed_swap;
+extern float compressed_swap_percent;
+
+void swapdevinfo (void);
+char *get_swapdev_status (int, int, const char *);
+void get_swapdev_perfdata (perfdata *);
+
+#endif
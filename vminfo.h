@@ -0,0 +1,153 @@
+#ifndef VMINFO_H_
+# define VMINFO_H_
+
+#include <stddef.h>
+
+#include "perfdata.h"
+
+/* linux: virtual memory statistics (/proc/vmstat) */
+
+extern unsigned long vm_pgmajfault;
+extern unsigned long vm_pgscan;
+extern unsigned long vm_pgsteal;
+extern unsigned long vm_allocstall;
+extern unsigned long vm_pgscan_direct;
+extern unsigned long vm_pgscan_kswapd;
+extern unsigned long vm_pgsteal_direct;
+extern unsigned long vm_pgsteal_kswapd;
+extern unsigned long vm_workingset_refault;
+extern unsigned long vm_workingset_activate;
+extern unsigned long vm_nr_dirtied;
+extern unsigned long vm_nr_written;
+extern unsigned long vm_nr_dirty_threshold;
+extern unsigned long vm_nr_dirty_background_threshold;
+extern unsigned long vm_oom_kill;
+
+/* linux: from /proc/meminfo */
+extern unsigned long kb_main_buffers;
+extern unsigned long kb_main_cached;
+extern unsigned long kb_main_free;
+extern unsigned long kb_main_memfree;
+extern unsigned long kb_active_file;
+extern unsigned long kb_inactive_file;
+extern unsigned long kb_shmem;
+extern unsigned long kb_main_available;
+extern unsigned long kb_dirty;
+extern unsigned long kb_writeback;
+extern unsigned long kb_swap_pageins;
+extern unsigned long kb_swap_pageouts;
+
+void vminfo (void);
+
+/* the memory usage of a /proc/meminfo snapshot (meminfo () fields) */
+void meminfo_snapshot (const char *, size_t, int);
+/* the memory used with an accounting, after meminfo (CACHE_IS_USED) */
+unsigned long meminfo_used (int);
+
+/* rates per second since the previous run of the plugin */
+extern double reclaim_direct_rate;
+extern double reclaim_efficiency;
+extern double reclaim_majfault_rate;
+
+void reclaiminfo (void);
+char *get_reclaim_status (int);
+void get_reclaim_perfdata (perfdata *);
+
+/* percentage of the page cache refaulted (or activated) per minute */
+extern double thrashing_refault;
+extern double thrashing_activate;
+
+void thrashinginfo (void);
+char *get_thrashing_status (void);
+void get_thrashing_perfdata (perfdata *);
+
+/* pages swapped in and out per second */
+extern double swap_pagein_rate;
+extern double swap_pageout_rate;
+
+void swaprateinfo (void);
+char *get_swaprate_status (void);
+void get_swaprate_perfdata (perfdata *);
+
+/* dirty and writeback memory, as percentage of the dirty threshold */
+extern double dirty_percent;
+
+void dirtyinfo (void);
+char *get_dirty_status (int, int, const char *);
+void get_dirty_perfdata (perfdata *);
+
+/* overcommit accounting: Committed_AS as percentage of CommitLimit */
+extern int overcommit_memory;
+extern float commit_percent;
+
+void commitinfo (void);
+char *get_commit_status (int, int, const char *);
+void get_commit_perfdata (perfdata *);
+
+/* memory not accounted by any /proc/meminfo field */
+extern unsigned long kb_unaccounted;
+extern float unaccounted_percent;
+
+void breakdowninfo (void);
+char *get_breakdown_status (int, int, const char *);
+void get_breakdown_perfdata (perfdata *);
+
+/* unreclaimable slab: percentage of MemTotal and growth in kB per hour */
+extern float slab_unreclaim_percent;
+extern double slab_unreclaim_growth;
+
+void slabinfo (void);
+char *get_slab_status (int, int, const char *);
+void get_slab_perfdata (perfdata *);
+
+/* KSM: memory saved, as percentage of MemTotal */
+extern int ksm_available;
+extern float ksm_saved_percent;
+
+void ksminfo (void);
+char *get_ksm_status (int, float, int, const char *);
+void get_ksm_perfdata (perfdata *);
+
+/* processes with a sustained RSS (or PSS) growth, in kB per hour */
+extern int leak_processes;
+extern int leak_growing;
+extern double leak_max_growth;
+
+void leakinfo (int);
+char *get_leak_status (int, int, const char *);
+void get_leak_perfdata (perfdata *);
+
+/* OOM kills, and memory.max and memory.high events of the memory cgroups,
+ * since the previous run
+ */
+extern unsigned long long oom_kills;
+extern unsigned long long oom_throttled;
+
+void oominfo (void);
+char *get_oom_status (int);
+void get_oom_perfdata (perfdata *);
+
+/* shared memory (Shmem): percentage of MemTotal, and where it lives */
+extern float shmem_percent;
+extern unsigned long kb_shmem_tmpfs;
+extern unsigned long kb_shmem_sysv;
+extern unsigned long kb_shmem_memfd;
+extern unsigned long kb_shmem_unattributed;
+
+void shmeminfo (void);
+char *get_shmem_status (int, int, const char *);
+void get_shmem_perfdata (perfdata *);
+
+/* memory of the TCP and UDP socket buffers: percentage of the max limits
+ * (net.ipv4.tcp_mem and udp_mem), and the pressure and max thresholds hit
+ */
+extern float sockets_tcp_percent;
+extern float sockets_udp_percent;
+extern int sockets_pressure;
+extern int sockets_limit;
+
+void sockstatinfo (void);
+char *get_sockstat_status (int, int, const char *);
+void get_sockstat_perfdata (perfdata *);
+
+#endif
@@ -0,0 +1,330 @@
+/*
+ * License: GPLv2
+ * Copyright (c) 2014 Davide Madrisan <davide.madrisan@gmail.com>
+ *
+ * A Nagios plugin to check the virtual memory activity on linux
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* activate extra prototypes for glibc */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "nputils.h"
+#include "procfs.h"
+#include "state.h"
+#include "vminfo.h"
+
+/* direct reclaim stalls: times a page allocator had to reclaim memory */
+double reclaim_direct_rate;
+/* pages reclaimed per hundred pages scanned */
+double reclaim_efficiency;
+double reclaim_majfault_rate;
+
+#define SU(X) ( ((unsigned long long)(X) << 10) >> shift ), units
+
+/* refaults of the evicted page cache pages, and the ones immediately
+ * activated because part of the workingset (thrashing)
+ */
+double thrashing_refault;
+double thrashing_activate;
+
+static double refault_rate;
+static double activate_rate;
+
+double dirty_percent;
+
+static unsigned long kb_dirty_thresh;
+static unsigned long kb_dirty_bg_thresh;
+static unsigned long kb_dirty_freerun;
+static double dirtied_rate;
+static double written_rate;
+
+double swap_pagein_rate;
+double swap_pageout_rate;
+
+static double pgscan_direct_rate;
+static double pgscan_kswapd_rate;
+static double pgsteal_direct_rate;
+static double pgsteal_kswapd_rate;
+
+void
+reclaiminfo (void)
+{
+  state *st;
+  double pgscan_rate, pgsteal_rate;
+
+  vminfo ();
+
+  st = state_open ("check_memory_reclaim");
+
+  state_rate (st, "allocstall", vm_allocstall, &reclaim_direct_rate);
+  state_rate (st, "pgmajfault", vm_pgmajfault, &reclaim_majfault_rate);
+  state_rate (st, "pgscan", vm_pgscan, &pgscan_rate);
+  state_rate (st, "pgsteal", vm_pgsteal, &pgsteal_rate);
+  state_rate (st, "pgscan_direct", vm_pgscan_direct, &pgscan_direct_rate);
+  state_rate (st, "pgscan_kswapd", vm_pgscan_kswapd, &pgscan_kswapd_rate);
+  state_rate (st, "pgsteal_direct", vm_pgsteal_direct, &pgsteal_direct_rate);
+  state_rate (st, "pgsteal_kswapd", vm_pgsteal_kswapd, &pgsteal_kswapd_rate);
+
+  state_save (st);
+  state_free (st);
+
+  /* no page scanned: nothing to be reclaimed, nothing wasted */
+  reclaim_efficiency = 100.0;
+  if (pgscan_rate > 0)
+    reclaim_efficiency = pgsteal_rate * 100.0 / pgscan_rate;
+  if (reclaim_efficiency > 100.0)
+    reclaim_efficiency = 100.0;
+}
+
+char *
+get_reclaim_status (int status)
+{
+  char *msg;
+  int ret;
+
+  ret = asprintf (&msg, "%s: direct reclaim %.2f/s, reclaim efficiency "
+		  "%.2f%%, major faults %.2f/s", state_text (status),
+		  reclaim_direct_rate, reclaim_efficiency,
+		  reclaim_majfault_rate);
+
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting reclaim status\n");
+
+  return msg;
+}
+
+void
+get_reclaim_perfdata (perfdata *pd)
+{
+  perfdata_add (pd, "vm_direct_reclaim", PERFDATA_NONE, reclaim_direct_rate);
+  perfdata_add (pd, "vm_reclaim_efficiency", PERFDATA_PERCENT,
+		reclaim_efficiency);
+  perfdata_add (pd, "vm_majfault", PERFDATA_NONE, reclaim_majfault_rate);
+  perfdata_add (pd, "vm_pgscan_kswapd", PERFDATA_NONE, pgscan_kswapd_rate);
+  perfdata_add (pd, "vm_pgscan_direct", PERFDATA_NONE, pgscan_direct_rate);
+  perfdata_add (pd, "vm_pgsteal_kswapd", PERFDATA_NONE, pgsteal_kswapd_rate);
+  perfdata_add (pd, "vm_pgsteal_direct", PERFDATA_NONE, pgsteal_direct_rate);
+}
+
+/*
+ * Must be called after meminfo(): the refault rates are relative to the
+ * size of the page cache
+ */
+void
+thrashinginfo (void)
+{
+  state *st;
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+  unsigned long cache_pages;
+
+  vminfo ();
+
+  st = state_open ("check_memory_thrashing");
+
+  state_rate (st, "workingset_refault", vm_workingset_refault,
+	      &refault_rate);
+  state_rate (st, "workingset_activate", vm_workingset_activate,
+	      &activate_rate);
+
+  state_save (st);
+  state_free (st);
+
+  thrashing_refault = thrashing_activate = 0;
+  if (kb_page <= 0)
+    kb_page = 4;
+  cache_pages = (kb_main_cached + kb_main_buffers) / kb_page;
+  if (cache_pages > 0)
+    {
+      thrashing_refault = refault_rate * 60 * 100.0 / cache_pages;
+      thrashing_activate = activate_rate * 60 * 100.0 / cache_pages;
+    }
+}
+
+char *
+get_thrashing_status (void)
+{
+  char *msg;
+  int ret;
+
+  ret = asprintf (&msg, "page cache refaults %.2f%%/min "
+		  "(workingset %.2f%%/min)",
+		  thrashing_refault, thrashing_activate);
+
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting thrashing status\n");
+
+  return msg;
+}
+
+void
+get_thrashing_perfdata (perfdata *pd)
+{
+  perfdata_add (pd, "vm_workingset_refault", PERFDATA_NONE, refault_rate);
+  perfdata_add (pd, "vm_workingset_activate", PERFDATA_NONE, activate_rate);
+  perfdata_add (pd, "cache_refault", PERFDATA_PERCENT, thrashing_refault);
+  perfdata_add (pd, "cache_activate", PERFDATA_PERCENT, thrashing_activate);
+}
+
+/*
+ * Must be called after swapinfo()
+ */
+void
+swaprateinfo (void)
+{
+  state *st = state_open ("check_swap_rates");
+
+  state_rate (st, "pswpin", kb_swap_pageins, &swap_pagein_rate);
+  state_rate (st, "pswpout", kb_swap_pageouts, &swap_pageout_rate);
+
+  state_save (st);
+  state_free (st);
+}
+
+char *
+get_swaprate_status (void)
+{
+  char *msg;
+  int ret;
+
+  ret = asprintf (&msg, "swap in %.2f pages/s, swap out %.2f pages/s",
+		  swap_pagein_rate, swap_pageout_rate);
+
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting swap rates status\n");
+
+  return msg;
+}
+
+void
+get_swaprate_perfdata (perfdata *pd)
+{
+  perfdata_add (pd, "swap_pagein_rate", PERFDATA_NONE, swap_pagein_rate);
+  perfdata_add (pd, "swap_pageout_rate", PERFDATA_NONE, swap_pageout_rate);
+}
+
+/*
+ * The limits of the dirty memory (see mm/page-writeback.c).
+ * Each one is set either in bytes or as a ratio of the dirtyable memory
+ * (the free memory plus the file cache); the background limit must be
+ * lower than the dirty one.  The writers are throttled in
+ * balance_dirty_pages() when the dirty and writeback memory exceeds the
+ * mid point between the two limits ("freerun" ceiling).
+ */
+static unsigned long
+dirty_limit (const char *bytes_file, const char *ratio_file,
+	     unsigned long kb_dirtyable, unsigned long long default_ratio)
+{
+  unsigned long long value;
+
+  if (read_file_ull (bytes_file, &value) && value > 0)
+    return value >> 10;
+  if (!read_file_ull (ratio_file, &value))
+    value = default_ratio;
+
+  return kb_dirtyable * value / 100;
+}
+
+/*
+ * Must be called after meminfo()
+ */
+void
+dirtyinfo (void)
+{
+  long kb_page = sysconf (_SC_PAGESIZE) / 1024;
+  unsigned long kb_dirtyable;
+  state *st;
+
+  vminfo ();
+
+  if (kb_page <= 0)
+    kb_page = 4;
+
+  /* Active(file) and Inactive(file) appeared in 2.6.28; the free memory
+   * is MemFree, whatever the accounting of the cache
+   */
+  if (kb_active_file || kb_inactive_file)
+    kb_dirtyable = kb_main_memfree + kb_active_file + kb_inactive_file;
+  else
+    kb_dirtyable = kb_main_memfree + kb_main_cached + kb_main_buffers;
+
+  kb_dirty_thresh =
+    dirty_limit (PROC_SYS_VM "dirty_bytes", PROC_SYS_VM "dirty_ratio",
+		 kb_dirtyable, 20);
+  kb_dirty_bg_thresh =
+    dirty_limit (PROC_SYS_VM "dirty_background_bytes",
+		 PROC_SYS_VM "dirty_background_ratio", kb_dirtyable, 10);
+  if (kb_dirty_bg_thresh >= kb_dirty_thresh)
+    kb_dirty_bg_thresh = kb_dirty_thresh / 2;
+
+  /* 2.6.37+ kernels export the limits they actually use, that also
+   * take into account the reserved pages and the highmem
+   */
+  if (vm_nr_dirty_threshold)
+    {
+      kb_dirty_thresh = vm_nr_dirty_threshold * kb_page;
+      kb_dirty_bg_thresh = vm_nr_dirty_background_threshold * kb_page;
+    }
+
+  kb_dirty_freerun = (kb_dirty_thresh + kb_dirty_bg_thresh) / 2;
+
+  dirty_percent = 0;
+  if (kb_dirty_thresh > 0)
+    dirty_percent = (kb_dirty + kb_writeback) * 100.0 / kb_dirty_thresh;
+
+  st = state_open ("check_memory_dirty");
+  state_rate (st, "nr_dirtied", vm_nr_dirtied, &dirtied_rate);
+  state_rate (st, "nr_written", vm_nr_written, &written_rate);
+  state_save (st);
+  state_free (st);
+}
+
+char *
+get_dirty_status (int status, int shift, const char *units)
+{
+  char *msg;
+  int ret;
+
+  ret = asprintf (&msg, "%s: %.2f%% of the dirty limit (%Lu%s) used, "
+		  "writers throttled at %.2f%%", state_text (status),
+		  dirty_percent, SU (kb_dirty_thresh),
+		  kb_dirty_thresh ? kb_dirty_freerun * 100.0 / kb_dirty_thresh
+		  : 0);
+
+  if (ret < 0)
+    die (STATE_UNKNOWN, "Error getting dirty memory status\n");
+
+  return msg;
+}
+
+void
+get_dirty_perfdata (perfdata *pd)
+{
+  perfdata_add (pd, "mem_dirty", PERFDATA_KB, kb_dirty);
+  perfdata_add (pd, "mem_writeback", PERFDATA_KB, kb_writeback);
+  perfdata_add (pd, "dirty_threshold", PERFDATA_KB, kb_dirty_thresh);
+  perfdata_add (pd, "dirty_background_threshold", PERFDATA_KB,
+		kb_dirty_bg_thresh);
+  perfdata_add (pd, "dirty_limit_used", PERFDATA_PERCENT, dirty_percent);
+  perfdata_add (pd, "vm_nr_dirtied", PERFDATA_NONE, dirtied_rate);
+  perfdata_add (pd, "vm_nr_written", PERFDATA_NONE, written_rate);
+}